@@ -0,0 +1,327 @@
+// project
+#include "net/async_server.hpp"
+#include "net/cpu_affinity.hpp"
+#include "net/latency_histogram.hpp"
+#include "net/tracer.hpp"
+
+// generated
+#include <testing/echo.grpc.pb.h>
+
+// third-party
+#include <grpcpp/create_channel.h>
+
+// standard
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+namespace tp = testing::proto;
+using EchoService = tp::Echo::WithRawMethod_ServerStreamEchoTest<tp::Echo::AsyncService>;
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string rpc = "unary"; // 'unary' or 'stream'
+    unsigned port = 50056u;
+    unsigned server_threads = 2u;
+    unsigned concurrency = 8u; // Client threads, each with its own channel and one call in flight
+    std::size_t payload_size = 64u; // Bytes in every request and response message
+    int stream_length = 100; // Responses per 'stream' call
+    std::size_t write_batch = 0u; // Messages per 'stream' write batch (see 'WriteBatchOptions'). Disabled if 0.
+    double warmup_seconds = 1.0;
+    double duration_seconds = 5.0;
+    std::string trace_file; // Where to write the server's Chrome trace (needs HELLO_ENABLE_TRACING)
+
+    // 'none' leaves threads to the scheduler. 'local' pins the server and the clients to the first NUMA
+    // node and 'remote' moves the clients to the last one, so every call crosses sockets.
+    std::string placement = "none";
+};
+
+void print_usage(const char* program) {
+    std::cerr << "usage: " << program << " [--rpc=unary|stream] [--port=N] [--server-threads=N] [--concurrency=N]\n"
+              << "       [--payload=BYTES] [--stream-length=N] [--write-batch=N] [--warmup=SECONDS]\n"
+              << "       [--duration=SECONDS] [--trace=FILE] [--placement=none|local|remote]\n";
+}
+
+BenchOptions parse_options(int argc, const char* argv[]) {
+    BenchOptions options{};
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto equals = arg.find('=');
+
+        if (arg.compare(0, 2, "--") != 0 || equals == std::string::npos) {
+            throw std::invalid_argument("Unrecognized argument '" + arg + "'");
+        }
+
+        std::string name = arg.substr(2u, equals - 2u);
+        std::string value = arg.substr(equals + 1u);
+
+        if (name == "rpc") {
+            if (value != "unary" && value != "stream") {
+                throw std::invalid_argument("--rpc must be 'unary' or 'stream'");
+            }
+            options.rpc = value;
+        } else if (name == "port") {
+            options.port = static_cast<unsigned>(std::stoul(value));
+        } else if (name == "server-threads") {
+            options.server_threads = static_cast<unsigned>(std::stoul(value));
+        } else if (name == "concurrency") {
+            options.concurrency = static_cast<unsigned>(std::stoul(value));
+        } else if (name == "payload") {
+            options.payload_size = std::stoul(value);
+        } else if (name == "stream-length") {
+            options.stream_length = std::stoi(value);
+        } else if (name == "write-batch") {
+            options.write_batch = std::stoul(value);
+        } else if (name == "warmup") {
+            options.warmup_seconds = std::stod(value);
+        } else if (name == "duration") {
+            options.duration_seconds = std::stod(value);
+        } else if (name == "trace") {
+            options.trace_file = value;
+        } else if (name == "placement") {
+            if (value != "none" && value != "local" && value != "remote") {
+                throw std::invalid_argument("--placement must be 'none', 'local' or 'remote'");
+            }
+            options.placement = value;
+        } else {
+            throw std::invalid_argument("Unrecognized option '--" + name + "'");
+        }
+    }
+    return options;
+}
+
+/**
+ * @brief The CPUs of the server's and the clients' threads for a placement (empty when not pinned).
+ */
+struct Placement {
+    std::vector<unsigned> server_cpus;
+    std::vector<unsigned> client_cpus;
+};
+
+Placement place(const std::string& placement) {
+    if (placement == "none") {
+        return {};
+    }
+
+    std::vector<unsigned> nodes = net::numa_nodes();
+    if (placement == "remote" && nodes.size() < 2u) {
+        throw std::invalid_argument("--placement=remote needs a machine with at least two NUMA nodes");
+    }
+
+    Placement cpus{net::numa_node_cpus(nodes.front()),
+                   net::numa_node_cpus(placement == "local" ? nodes.front() : nodes.back())};
+
+    if (cpus.server_cpus.empty() || cpus.client_cpus.empty()) {
+        throw std::invalid_argument("The benchmark isn't allowed to run on the NUMA nodes it needs");
+    }
+    return cpus;
+}
+
+/**
+ * @brief What one client thread saw while the benchmark was being measured.
+ */
+struct ClientResults {
+    net::LatencyHistogram latencies;
+    std::uint64_t messages = 0u;
+    std::uint64_t errors = 0u;
+};
+
+/**
+ * @brief Makes one call at a time until `stop` is set, recording the calls that start after
+ *        `measuring` is set. A streaming call's latency covers reading every response.
+ */
+ClientResults run_client(const BenchOptions& options,
+                         const std::string& server_address,
+                         const std::vector<unsigned>& cpus,
+                         const std::atomic_bool& measuring,
+                         const std::atomic_bool& stop) {
+    // Pinned before anything is allocated so the client's memory is on its own node too
+    if (!cpus.empty()) {
+        net::pin_current_thread(cpus);
+    }
+
+    grpc::ChannelArguments channel_args;
+    // Keep every client on its own connection instead of sharing one subchannel
+    channel_args.SetInt("grpc.use_local_subchannel_pool", 1);
+
+    auto channel = grpc::CreateCustomChannel(server_address, grpc::InsecureChannelCredentials(), channel_args);
+    auto stub = tp::Echo::NewStub(channel);
+
+    tp::EchoRequest request{};
+    request.set_message(std::string(options.payload_size, 'x'));
+    request.set_expected_responses(options.stream_length);
+
+    tp::EchoResponse response{};
+    ClientResults results{};
+
+    while (!stop) {
+        bool measured = measuring;
+        auto start = Clock::now();
+
+        grpc::ClientContext context;
+        grpc::Status status;
+        std::uint64_t messages = 0u;
+
+        if (options.rpc == "unary") {
+            status = stub->UnaryEchoTest(&context, request, &response);
+            messages = 1u;
+        } else {
+            auto reader = stub->ServerStreamEchoTest(&context, request);
+            while (reader->Read(&response)) {
+                ++messages;
+            }
+            status = reader->Finish();
+        }
+
+        auto end = Clock::now();
+
+        if (!measured || !measuring) {
+            continue;
+        }
+        if (status.ok()) {
+            results.latencies.record(end - start);
+            results.messages += messages;
+        } else {
+            ++results.errors;
+        }
+    }
+    return results;
+}
+
+void register_echo_rpcs(net::AsyncServer<tp::Echo, EchoService>* server, const BenchOptions& options) {
+    std::string payload(options.payload_size, 'x');
+
+    net::RpcOptions stream_options{};
+    stream_options.write_batch.max_messages = options.write_batch;
+
+    server->register_rpc(&EchoService::RequestUnaryEchoTest,
+                         [](const tp::EchoRequest& request, tp::EchoResponse* response) {
+                             response->set_message(request.message());
+                             response->set_response_number(1);
+                             return grpc::Status::OK;
+                         });
+
+    server->register_rpc(net::raw_stream<tp::EchoRequest, tp::EchoResponse>(&EchoService::RequestServerStreamEchoTest),
+                         [payload](const tp::EchoRequest& request, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                             for (int i = 0; i < request.expected_responses(); ++i) {
+                                 stream->emplace([&payload, i](tp::EchoResponse& response) {
+                                     response.set_message(payload);
+                                     response.set_response_number(i);
+                                 });
+                             }
+                             stream->finish(grpc::Status::OK);
+                         },
+                         {},
+                         stream_options);
+}
+
+double to_microseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+    BenchOptions options{};
+    Placement placement{};
+
+    try {
+        options = parse_options(argc, argv);
+        placement = place(options.placement);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    net::PlacementOptions server_placement{};
+    if (!placement.server_cpus.empty()) {
+        server_placement.poller_cpus = {placement.server_cpus};
+    }
+
+    net::AsyncServer<tp::Echo, EchoService> server(options.port,
+                                                   options.server_threads,
+                                                   /*num_handler_threads=*/0u,
+                                                   net::AdmissionOptions{},
+                                                   /*reuse_port=*/false,
+                                                   server_placement);
+    register_echo_rpcs(&server, options);
+
+    std::thread server_thread([&server] { server.run(); });
+
+    std::string server_address = "127.0.0.1:" + std::to_string(options.port);
+
+    std::atomic_bool measuring{false};
+    std::atomic_bool stop{false};
+
+    std::vector<ClientResults> results(options.concurrency);
+    std::vector<std::thread> clients;
+
+    for (auto c = 0u; c < options.concurrency; ++c) {
+        clients.emplace_back([&, c] {
+            results[c] = run_client(options, server_address, placement.client_cpus, measuring, stop);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup_seconds));
+    net::Tracer::global().clear();
+    measuring = true;
+    auto start = Clock::now();
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration_seconds));
+    measuring = false;
+    auto end = Clock::now();
+
+    stop = true;
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    server.shutdown();
+    server_thread.join();
+
+    if (!options.trace_file.empty()) {
+        if (!net::Tracer::compiled_in) {
+            std::cerr << "Tracing is disabled. Configure with -DHELLO_ENABLE_TRACING=ON to record a trace.\n";
+        } else {
+            std::ofstream trace(options.trace_file);
+            net::Tracer::global().write_chrome_trace(trace);
+        }
+    }
+
+    ClientResults total{};
+    for (const auto& client_results : results) {
+        total.latencies.merge(client_results.latencies);
+        total.messages += client_results.messages;
+        total.errors += client_results.errors;
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    const net::LatencyHistogram& latencies = total.latencies;
+
+    // A single JSON object so runs can be collected and compared by scripts
+    std::cout << "{\"rpc\": \"" << options.rpc << "\", \"placement\": \"" << options.placement
+              << "\", \"server_threads\": " << options.server_threads
+              << ", \"concurrency\": " << options.concurrency << ", \"payload_bytes\": " << options.payload_size
+              << ", \"stream_length\": " << (options.rpc == "unary" ? 1 : options.stream_length)
+              << ", \"write_batch\": " << options.write_batch
+              << ", \"duration_s\": " << seconds << ", \"calls\": " << latencies.count()
+              << ", \"errors\": " << total.errors << ", \"qps\": " << static_cast<double>(latencies.count()) / seconds
+              << ", \"messages_per_s\": " << static_cast<double>(total.messages) / seconds << ", \"latency_us\": {"
+              << "\"mean\": " << to_microseconds(latencies.mean())
+              << ", \"p50\": " << to_microseconds(latencies.percentile(0.5))
+              << ", \"p99\": " << to_microseconds(latencies.percentile(0.99))
+              << ", \"p999\": " << to_microseconds(latencies.percentile(0.999))
+              << ", \"max\": " << to_microseconds(latencies.max()) << "}}" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+// project
+#include "net/tagger.hpp"
+
+// standard
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief The original map based tagger, kept here as the baseline for comparison.
+ */
+class MapTagger {
+public:
+    struct Tag {
+        net::detail::TagLabel label;
+        void* data;
+    };
+
+    void* make_tag(net::detail::TagLabel label, void* data) {
+        auto tag = std::make_unique<Tag>(Tag{label, data});
+        void* tag_id = tag.get();
+        tags_.emplace(tag_id, std::move(tag));
+        counts_[data] += 1;
+        return tag_id;
+    }
+
+    std::pair<Tag, unsigned> get_tag(void* tag_id) {
+        Tag tag = *tags_.at(tag_id);
+        tags_.erase(tag_id);
+
+        counts_.at(tag.data) -= 1;
+        unsigned count = counts_.at(tag.data);
+
+        if (count == 0) {
+            counts_.erase(tag.data);
+        }
+
+        return std::make_pair(tag, count);
+    }
+
+private:
+    std::unordered_map<void*, std::unique_ptr<Tag>> tags_;
+    std::unordered_map<void*, unsigned> counts_;
+};
+
+struct FakeConnection {
+    net::detail::TagCount tag_count{0u};
+    net::detail::Tag processing_tag{net::detail::TagLabel::processing, this, &tag_count};
+    net::detail::Tag finished_tag{net::detail::TagLabel::rpc_finished, this, &tag_count};
+};
+
+/**
+ * @brief Every connection keeps a 'finished' tag on the queue while a 'processing' tag is repeatedly
+ *        added and removed, mimicking a completion queue full of streaming connections.
+ */
+template <typename MakeTag, typename GetTag>
+double events_per_second(std::vector<FakeConnection>& connections,
+                         unsigned rounds,
+                         MakeTag&& make_tag,
+                         GetTag&& get_tag) {
+    std::vector<void*> finished_ids;
+    std::vector<void*> queue;
+    finished_ids.reserve(connections.size());
+    queue.reserve(connections.size());
+
+    unsigned checksum = 0u;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto& connection : connections) {
+        finished_ids.emplace_back(make_tag(&connection.finished_tag));
+    }
+
+    for (auto r = 0u; r < rounds; ++r) {
+        for (auto& connection : connections) {
+            queue.emplace_back(make_tag(&connection.processing_tag));
+        }
+        for (void* tag_id : queue) {
+            checksum += get_tag(tag_id);
+        }
+        queue.clear();
+    }
+
+    for (void* tag_id : finished_ids) {
+        checksum += get_tag(tag_id);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    // Keep the optimizer from removing the loop
+    if (checksum == 0u) {
+        std::cerr << "unexpected checksum" << std::endl;
+    }
+
+    double events = static_cast<double>(connections.size()) * static_cast<double>(rounds + 1u);
+    return events / std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+
+    unsigned num_connections = 1000u;
+    unsigned rounds = 2000u;
+
+    if (argc > 1) {
+        num_connections = static_cast<unsigned>(std::stoul(argv[1]));
+    }
+
+    if (argc > 2) {
+        rounds = static_cast<unsigned>(std::stoul(argv[2]));
+    }
+
+    std::vector<FakeConnection> connections(num_connections);
+
+    MapTagger map_tagger;
+    double map_rate = events_per_second(
+        connections,
+        rounds,
+        [&map_tagger](net::detail::Tag* tag) { return map_tagger.make_tag(tag->label, tag->data); },
+        [&map_tagger](void* tag_id) { return map_tagger.get_tag(tag_id).second; });
+
+    double intrusive_rate = events_per_second(
+        connections,
+        rounds,
+        [](net::detail::Tag* tag) { return net::detail::Tagger::make_tag(tag); },
+        [](void* tag_id) { return net::detail::Tagger::get_tag(tag_id).second; });
+
+    std::cout << "connections: " << num_connections << ", rounds: " << rounds << '\n'
+              << "map tagger:       " << map_rate << " events/sec\n"
+              << "intrusive tagger: " << intrusive_rate << " events/sec\n"
+              << "speedup:          " << intrusive_rate / map_rate << "x" << std::endl;
+
+    return 0;
+}
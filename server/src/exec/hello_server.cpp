@@ -1,106 +1,330 @@
 // project
-#include "net/async_server.hpp"
-
-// generated
-#include <hello/hello.grpc.pb.h>
+#include "hello/hello_server.hpp"
+#include "net/cpu_affinity.hpp"
 
 // system
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// standard
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
 #include <iostream>
-#include <net/server_to_client_stream.hpp>
-
-namespace hello {
-
-class HelloServer {
-public:
-    explicit HelloServer(unsigned port) : server_(port) {
-
-        server_.register_rpc(&proto::Greeter::AsyncService::RequestSayHello,
-                             [this](const proto::HelloRequest& request, proto::HelloResponse* response) {
-                                 return say_hello(request, response);
-                             });
-
-        server_.register_rpc(&proto::Greeter::AsyncService::RequestGetAllTransactions,
-                             [this](const google::protobuf::Empty& request,
-                                    net::ServerToClientStream<proto::HelloTransaction>* stream) {
-                                 get_all_transactions(request, stream);
-                             });
-
-        server_.register_rpc(&proto::Greeter::AsyncService::RequestMaybeSayHello,
-                             [this](const proto::HelloRequest& request, google::protobuf::Empty* response) {
-                                 return maybe_say_hello(request, response);
-                             });
-
-        server_.register_rpc(&proto::Greeter::AsyncService::RequestGetTransactionUpdates,
-                             [this](const google::protobuf::Empty& /*request*/,
-                                    net::ServerToClientStream<proto::HelloTransaction>* stream) {
-                                 client_streams_.emplace(stream);
-                             },
-                             [this](void* stream) {
-                                 auto stream_ptr
-                                     = static_cast<net::ServerToClientStream<proto::HelloTransaction>*>(stream);
-                                 assert(client_streams_.find(stream_ptr) != client_streams_.end());
-                                 client_streams_.erase(stream_ptr);
-                             });
-    }
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 
-    void run() { server_.run(); }
+namespace {
 
-private:
-    net::AsyncServer<proto::Greeter> server_;
-    std::vector<proto::HelloTransaction> transactions_;
-    std::unordered_set<net::ServerToClientStream<proto::HelloTransaction>*> client_streams_;
+struct Settings {
+    unsigned port = 9090u;
+    unsigned num_threads = 1u; // Completion queues, each polled by its own thread
+    unsigned metrics_port = 0u; // Serves Prometheus metrics on localhost. Disabled if 0.
+    std::size_t greeting_cache_size = 0u; // Greetings kept for repeated names. Disabled if 0.
+    unsigned num_workers = 0u; // Worker processes sharing the port. The server runs in this process if 0.
+    hello::TransactionLogOptions log_options{};
+    net::PlacementOptions placement{};
+};
+
+void print_usage(const char* program) {
+    std::cerr << "usage: " << program << " [--port=N] [--threads=N] [--log-dir=PATH] [--metrics-port=N]\n"
+              << "       [--greeting-cache=N] [--workers=N] [--sync-interval-ms=N]\n";
+}
 
-    grpc::Status say_hello(const proto::HelloRequest& request, proto::HelloResponse* response) {
+Settings parse_settings(int argc, const char* argv[]) {
+    Settings settings{};
+    settings.log_options.directory = "transactions";
 
-        response->set_message("Hello, " + request.name() + "!");
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto equals = arg.find('=');
 
-        proto::HelloTransaction transaction;
-        *transaction.mutable_request() = request;
-        *transaction.mutable_response() = *response;
+        if (arg.compare(0, 2, "--") != 0 || equals == std::string::npos) {
+            throw std::invalid_argument("Unrecognized argument '" + arg + "'");
+        }
 
-        transactions_.emplace_back(std::move(transaction));
+        std::string name = arg.substr(2u, equals - 2u);
+        std::string value = arg.substr(equals + 1u);
 
-        return grpc::Status::OK;
+        if (name == "port") {
+            settings.port = static_cast<unsigned>(std::stoul(value));
+        } else if (name == "threads") {
+            settings.num_threads = static_cast<unsigned>(std::stoul(value));
+        } else if (name == "log-dir") {
+            settings.log_options.directory = value;
+        } else if (name == "metrics-port") {
+            settings.metrics_port = static_cast<unsigned>(std::stoul(value));
+        } else if (name == "greeting-cache") {
+            settings.greeting_cache_size = std::stoul(value);
+        } else if (name == "workers") {
+            settings.num_workers = static_cast<unsigned>(std::stoul(value));
+        } else if (name == "sync-interval-ms") {
+            settings.log_options.sync_interval = std::chrono::milliseconds(std::stoul(value));
+        } else {
+            throw std::invalid_argument("Unrecognized option '--" + name + "'");
+        }
     }
+    return settings;
+}
 
-    void get_all_transactions(const google::protobuf::Empty& /*request*/,
-                              net::ServerToClientStream<proto::HelloTransaction>* stream) {
+sigset_t stop_signals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    return signals;
+}
 
-        for (const auto& transaction : transactions_) {
-            stream->write(transaction);
-        }
+/**
+ * @brief Runs a server until SIGINT or SIGTERM is received, then drains it.
+ */
+void serve(const Settings& settings, bool reuse_port) {
+    // Blocked before any other thread starts so only 'signal_thread' receives them
+    sigset_t signals = stop_signals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    hello::HelloServer hello_server(/*port=*/settings.port,
+                                    /*num_threads=*/settings.num_threads,
+                                    /*log_options=*/settings.log_options,
+                                    /*metrics_port=*/settings.metrics_port,
+                                    /*greeting_cache_size=*/settings.greeting_cache_size,
+                                    /*reuse_port=*/reuse_port,
+                                    /*placement=*/settings.placement);
+
+    // Deploys stop the server with SIGTERM. Calls get a few seconds to finish before they're cut off.
+    std::thread signal_thread([&signals, &hello_server] {
+        int signal = 0;
+        sigwait(&signals, &signal);
 
-        stream->finish(grpc::Status::OK);
+        std::cout << "Draining..." << std::endl;
+        hello_server.drain(std::chrono::seconds(10));
+    });
+
+    hello_server.run();
+    signal_thread.join();
+}
+
+/**
+ * @brief `count` of the CPUs this process is allowed on, starting from the `first` one and wrapping
+ *        around when there are fewer.
+ */
+std::vector<unsigned> pick_cpus(unsigned first, unsigned count) {
+    std::vector<unsigned> allowed = net::allowed_cpus();
+    std::vector<unsigned> cpus;
+
+    for (unsigned i = 0u; i < count; ++i) {
+        cpus.push_back(allowed[(first + i) % allowed.size()]);
     }
+    return cpus;
+}
 
-    grpc::Status maybe_say_hello(const proto::HelloRequest& request, google::protobuf::Empty* /*response*/) {
+/**
+ * @brief Forks a worker process that pins itself to its own CPUs and serves on the shared port. Each
+ *        worker keeps its transactions in its own log and serves metrics on its own port.
+ * @return the worker's pid
+ */
+pid_t start_worker(const Settings& settings, unsigned worker) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to fork a worker");
+    }
+    if (pid > 0) {
+        return pid;
+    }
+
+    // Only the stop signals stay blocked, for the worker's own signal thread
+    sigset_t signals = stop_signals();
+    pthread_sigmask(SIG_SETMASK, &signals, nullptr);
 
-        proto::HelloTransaction transaction;
-        *transaction.mutable_request() = request;
-        transaction.mutable_response()->set_message("Hello, " + request.name() + "!");
+    int exit_code = 0;
+    try {
+        Settings worker_settings = settings;
 
-        for (net::ServerToClientStream<proto::HelloTransaction>* client_stream : client_streams_) {
-            client_stream->write(transaction);
+        // gRPC's own threads stay on the worker's CPUs and each completion queue thread gets one to itself
+        std::vector<unsigned> cpus = pick_cpus(worker * settings.num_threads, settings.num_threads);
+        net::pin_current_thread(cpus);
+        for (unsigned cpu : cpus) {
+            worker_settings.placement.poller_cpus.push_back({cpu});
         }
 
-        transactions_.emplace_back(std::move(transaction));
+        worker_settings.log_options.directory += "/worker-" + std::to_string(worker);
+        if (worker_settings.metrics_port != 0u) {
+            worker_settings.metrics_port += worker;
+        }
+        serve(worker_settings, /*reuse_port=*/true);
 
-        return grpc::Status::OK;
+    } catch (const std::exception& e) {
+        std::cerr << "Worker " << worker << " failed: " << e.what() << std::endl;
+        exit_code = 1;
     }
+    std::exit(exit_code);
+}
+
+// Workers killed by a signal are restarted after a delay that doubles with every restart in the last
+// 'restart_window', and given up on after 'max_restarts' of them, so a worker that crashes as soon as
+// it starts isn't forked over and over
+constexpr std::chrono::milliseconds first_restart_delay(100);
+constexpr std::size_t max_restarts = 5u;
+constexpr std::chrono::seconds restart_window(60);
+
+struct Worker {
+    pid_t pid = 0;
+    std::deque<std::chrono::steady_clock::time_point> restarts; // The ones within 'restart_window'
+    std::chrono::steady_clock::time_point restart_at{}; // Set while the worker waits to be restarted
 };
 
-} // namespace hello
+/**
+ * @brief Runs `settings.num_workers` worker processes sharing the port, with the kernel spreading new
+ *        connections between them. Workers that crash are replaced (see `max_restarts`). SIGINT and
+ *        SIGTERM are passed on to every worker, and this returns once they have all drained and exited.
+ *
+ *     Workers don't share any state, so a transaction stream only sees the transactions of the worker
+ *     it's connected to.
+ */
+int supervise(const Settings& settings) {
+    using Clock = std::chrono::steady_clock;
 
-int main(int argc, const char* argv[]) {
+    // Must happen before forking since gRPC threads don't survive a fork
+    if (::mkdir(settings.log_options.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::system_error(errno, std::generic_category(), "Failed to create " + settings.log_options.directory);
+    }
 
-    unsigned port = 9090u;
+    sigset_t signals = stop_signals();
+    sigaddset(&signals, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
-    if (argc > 1) {
-        port = static_cast<unsigned>(std::stoul(argv[1]));
+    std::vector<Worker> workers(settings.num_workers);
+    for (unsigned worker = 0u; worker < settings.num_workers; ++worker) {
+        workers[worker].pid = start_worker(settings, worker);
     }
 
-    hello::HelloServer hello_server(/*port=*/port);
-    hello_server.run();
+    std::size_t running = workers.size();
+    std::size_t waiting = 0u; // Workers waiting to be restarted
+    bool stopping = false;
+    int exit_code = 0;
+
+    while (running > 0u || waiting > 0u) {
+        int signal = 0;
+
+        if (waiting == 0u) {
+            sigwait(&signals, &signal);
+        } else {
+            Clock::time_point next_restart = Clock::time_point::max();
+            for (const Worker& worker : workers) {
+                if (worker.restart_at != Clock::time_point{}) {
+                    next_restart = std::min(next_restart, worker.restart_at);
+                }
+            }
+
+            auto timeout = std::max(Clock::duration::zero(), next_restart - Clock::now());
+            auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+            timespec wait_time{static_cast<std::time_t>(seconds.count()),
+                               static_cast<long>(std::chrono::nanoseconds(timeout - seconds).count())};
+
+            signal = sigtimedwait(&signals, nullptr, &wait_time);
+            if (signal < 0) {
+                Clock::time_point now = Clock::now();
+                for (unsigned worker = 0u; worker < workers.size(); ++worker) {
+                    if (workers[worker].restart_at != Clock::time_point{} && workers[worker].restart_at <= now) {
+                        workers[worker].restart_at = {};
+                        workers[worker].pid = start_worker(settings, worker);
+                        --waiting;
+                        ++running;
+                    }
+                }
+                continue;
+            }
+        }
+
+        if (signal != SIGCHLD) {
+            if (!stopping) {
+                std::cout << "Draining workers..." << std::endl;
+                for (Worker& worker : workers) {
+                    if (worker.pid > 0) {
+                        kill(worker.pid, SIGTERM);
+                    }
+                    worker.restart_at = {};
+                }
+                waiting = 0u;
+            }
+            stopping = true;
+            continue;
+        }
+
+        // Signals don't queue so one SIGCHLD can stand for several workers exiting
+        int status = 0;
+        pid_t pid = 0;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto index = static_cast<unsigned>(
+                std::find_if(workers.begin(), workers.end(), [pid](const Worker& worker) { return worker.pid == pid; })
+                - workers.begin());
+            Worker& worker = workers[index];
+            worker.pid = 0;
+            --running;
+
+            // Workers that exit on their own (e.g. because they failed to start) aren't restarted so a
+            // bad setting doesn't keep them restarting forever
+            if (!stopping && WIFSIGNALED(status)) {
+                Clock::time_point now = Clock::now();
+                while (!worker.restarts.empty() && now - worker.restarts.front() > restart_window) {
+                    worker.restarts.pop_front();
+                }
 
+                if (worker.restarts.size() >= max_restarts) {
+                    std::cerr << "Worker " << index << " was killed by signal " << WTERMSIG(status) << " after "
+                              << max_restarts << " restarts, giving up on it" << std::endl;
+                    exit_code = 1;
+                    continue;
+                }
+
+                auto delay = first_restart_delay * (1 << worker.restarts.size());
+                std::cerr << "Worker " << index << " was killed by signal " << WTERMSIG(status) << ", restarting it in "
+                          << delay.count() << "ms" << std::endl;
+
+                worker.restarts.push_back(now);
+                worker.restart_at = now + delay;
+                ++waiting;
+            } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                exit_code = 1;
+            }
+        }
+    }
+    return exit_code;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+    Settings settings{};
+
+    try {
+        settings = parse_settings(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Settings that only fail once the server starts (e.g. a greeting cache too small to shard or a log
+    // directory that can't be created) are reported the same way
+    try {
+        if (settings.num_workers > 0u) {
+            return supervise(settings);
+        }
+        serve(settings, /*reuse_port=*/false);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        print_usage(argv[0]);
+        return 1;
+    }
     return 0;
 }
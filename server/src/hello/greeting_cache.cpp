@@ -0,0 +1,152 @@
+#include "greeting_cache.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// standard
+#include <functional>
+#include <stdexcept>
+
+namespace hello {
+
+void build_greeting(const std::string& name, proto::HelloResponse* response) {
+    std::string* message = response->mutable_message();
+    message->clear();
+    message->reserve(name.size() + 8u);
+    message->append("Hello, ").append(name).append("!");
+}
+
+namespace {
+
+proto::HelloResponse greeting_for(const std::string& name) {
+    proto::HelloResponse response;
+    build_greeting(name, &response);
+    return response;
+}
+
+} // namespace
+
+Greeting::Greeting(const std::string& name) : response(greeting_for(name)), serialized(response) {}
+
+GreetingCache::GreetingCache(std::size_t capacity, std::size_t num_shards) {
+    if (num_shards == 0u || capacity < num_shards) {
+        throw std::invalid_argument("The greeting cache needs room for at least one greeting per shard");
+    }
+
+    shard_capacity_ = capacity / num_shards;
+    for (std::size_t i = 0u; i < num_shards; ++i) {
+        shards_.emplace_back(std::make_unique<Shard>());
+        shards_.back()->entries.reserve(shard_capacity_);
+        shards_.back()->positions.reserve(shard_capacity_);
+    }
+}
+
+std::shared_ptr<const Greeting> GreetingCache::greet(const std::string& name) {
+    if (name.size() > max_name_size) {
+        misses_.fetch_add(1u, std::memory_order_relaxed);
+        return std::make_shared<const Greeting>(name);
+    }
+
+    std::size_t hash = std::hash<std::string>{}(name);
+    Shard& shard = *shards_[hash % shards_.size()];
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto position = shard.positions.find(name);
+
+        if (position != shard.positions.end()) {
+            Entry& entry = shard.entries[position->second];
+            entry.referenced = true;
+
+            hits_.fetch_add(1u, std::memory_order_relaxed);
+            return entry.greeting;
+        }
+    }
+
+    // Built without the lock. Another thread may build the same greeting meanwhile, in which case
+    // the first one cached wins.
+    misses_.fetch_add(1u, std::memory_order_relaxed);
+    auto greeting = std::make_shared<const Greeting>(name);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.positions.find(name) != shard.positions.end()) {
+        return greeting;
+    }
+
+    // New entries start unreferenced so a name seen once is the first to go
+    if (shard.entries.size() < shard_capacity_) {
+        shard.positions.emplace(name, shard.entries.size());
+        shard.entries.push_back(Entry{name, greeting, false});
+        return greeting;
+    }
+
+    std::size_t index = evict(shard);
+    Entry& entry = shard.entries[index];
+
+    shard.positions.erase(entry.name);
+    entry.name = name;
+    entry.greeting = greeting;
+    entry.referenced = false;
+    shard.positions.emplace(name, index);
+
+    evictions_.fetch_add(1u, std::memory_order_relaxed);
+    return greeting;
+}
+
+GreetingCacheStats GreetingCache::stats() const {
+    GreetingCacheStats stats{hits_.load(std::memory_order_relaxed),
+                             misses_.load(std::memory_order_relaxed),
+                             evictions_.load(std::memory_order_relaxed),
+                             0u};
+
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats.size += shard->entries.size();
+    }
+    return stats;
+}
+
+std::size_t GreetingCache::evict(Shard& shard) {
+    while (shard.entries[shard.hand].referenced) {
+        shard.entries[shard.hand].referenced = false;
+        shard.hand = (shard.hand + 1u) % shard.entries.size();
+    }
+
+    std::size_t index = shard.hand;
+    shard.hand = (shard.hand + 1u) % shard.entries.size();
+    return index;
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("[hello] test GreetingCache keeps the names that keep coming back") {
+    GreetingCache cache(/*capacity=*/2u, /*num_shards=*/1u);
+
+    std::shared_ptr<const Greeting> hot = cache.greet("hot");
+    CHECK(hot->response.message() == "Hello, hot!");
+    CHECK(hot->serialized.parse().message() == "Hello, hot!");
+
+    // Hits share the cached greeting
+    CHECK(cache.greet("hot") == hot);
+
+    // "hot" is referenced so the cold names replace each other instead
+    for (const char* name : {"cold 1", "cold 2", "cold 3"}) {
+        CHECK(cache.greet(name)->response.message() == std::string("Hello, ") + name + "!");
+        CHECK(cache.greet("hot") == hot);
+    }
+
+    GreetingCacheStats stats = cache.stats();
+    CHECK(stats.hits == 4u);
+    CHECK(stats.misses == 4u);
+    CHECK(stats.evictions == 2u);
+    CHECK(stats.size == 2u);
+
+    // Long names are greeted without being cached
+    std::string long_name(GreetingCache::max_name_size + 1u, 'x');
+    cache.greet(long_name);
+    CHECK(cache.greet(long_name)->response.message() == "Hello, " + long_name + "!");
+    CHECK(cache.stats().misses == 6u);
+    CHECK(cache.stats().size == 2u);
+}
+#endif
+
+} // namespace hello
@@ -0,0 +1,103 @@
+#pragma once
+
+// project
+#include "net/serialized_message.hpp"
+
+// generated
+#include <hello/hello.pb.h>
+
+// standard
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hello {
+
+/**
+ * @brief Sets `response` to the greeting for `name`.
+ */
+void build_greeting(const std::string& name, proto::HelloResponse* response);
+
+/**
+ * @brief The greeting for a name along with its wire format, so it's serialized once however many
+ *        times it's sent.
+ */
+struct Greeting {
+    explicit Greeting(const std::string& name);
+
+    proto::HelloResponse response;
+    net::SerializedMessage<proto::HelloResponse> serialized;
+};
+
+struct GreetingCacheStats {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t evictions;
+    std::size_t size;
+};
+
+/**
+ * @brief Keeps the greetings built for the most requested names so the same few names don't have their
+ *        greeting rebuilt on every call.
+ *
+ *     Names are spread over shards that each have their own lock, so threads greeting different names
+ *     rarely wait on each other. Each shard evicts with the CLOCK algorithm: a hit only marks its entry as
+ *     referenced and the hand skips referenced entries once (clearing the mark) when looking for one to
+ *     replace, which keeps hits as cheap as a lookup while approximating LRU.
+ *
+ *     Names longer than `max_name_size` are never cached so a few odd requests can't fill the memory
+ *     the cache was sized for. Safe to use from any thread.
+ */
+class GreetingCache {
+public:
+    static constexpr std::size_t max_name_size = 256u;
+
+    /**
+     * @param capacity - The most greetings kept, split evenly over the shards
+     */
+    explicit GreetingCache(std::size_t capacity, std::size_t num_shards = 16u);
+
+    GreetingCache(const GreetingCache&) = delete;
+    GreetingCache& operator=(const GreetingCache&) = delete;
+
+    /**
+     * @brief The greeting for `name`, building and caching it if it isn't cached yet. Greetings are
+     *        immutable and shared with the cache, so a hit doesn't copy anything.
+     */
+    std::shared_ptr<const Greeting> greet(const std::string& name);
+
+    GreetingCacheStats stats() const;
+
+private:
+    struct Entry {
+        std::string name;
+        std::shared_ptr<const Greeting> greeting;
+        bool referenced;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::vector<Entry> entries;
+        std::unordered_map<std::string, std::size_t> positions; // Each name's index in 'entries'
+        std::size_t hand = 0u;
+    };
+
+    std::size_t shard_capacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    std::atomic<std::uint64_t> hits_{0u};
+    std::atomic<std::uint64_t> misses_{0u};
+    std::atomic<std::uint64_t> evictions_{0u};
+
+    /**
+     * @brief Finds the entry to replace, moving the hand past it. `shard.mutex` must be held.
+     */
+    std::size_t evict(Shard& shard);
+};
+
+} // namespace hello
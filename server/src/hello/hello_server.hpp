@@ -0,0 +1,356 @@
+#pragma once
+
+// project
+#include "hello/greeting_cache.hpp"
+#include "hello/transaction_log.hpp"
+#include "net/async_server.hpp"
+#include "net/metrics_endpoint.hpp"
+#include "net/server_to_client_stream.hpp"
+#include "testing/testing.hpp"
+
+// generated
+#include <hello/hello.grpc.pb.h>
+
+// standard
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+
+namespace hello {
+
+// 'SayHello' answers with greetings serialized once and sent from the cache as raw bytes. The transaction
+// streams are raw too since they write serialized records (see `net::raw_stream`).
+using GreeterService = proto::Greeter::WithRawMethod_SayHello<proto::Greeter::WithRawMethod_GetAllTransactions<
+    proto::Greeter::WithRawMethod_GetTransactions<
+        proto::Greeter::WithRawMethod_GetTransactionUpdates<proto::Greeter::AsyncService>>>>;
+
+class HelloServer {
+public:
+    // Pages of the transaction streams. Larger requested pages are cut down to the largest so a client
+    // can't make the server hold the whole history in a stream's send queue.
+    static constexpr std::size_t default_page_size = 64u;
+    static constexpr std::size_t max_page_size = 1024u;
+
+    /**
+     * @param metrics_port - Serves Prometheus metrics on localhost at this port. Disabled if 0.
+     * @param greeting_cache_size - The most greetings 'SayHello' keeps for repeated names. Disabled if 0.
+     * @param reuse_port - Shares the port with other processes running a HelloServer that opted in too
+     * @param placement - Which CPUs the server's completion queue threads run on
+     */
+    HelloServer(unsigned port,
+                unsigned num_threads,
+                TransactionLogOptions log_options,
+                unsigned metrics_port,
+                std::size_t greeting_cache_size,
+                bool reuse_port = false,
+                const net::PlacementOptions& placement = net::PlacementOptions{})
+        : transactions_(std::move(log_options)),
+          // Made before the server starts listening so a bad size fails without a server to stop
+          greetings_(greeting_cache_size != 0u ? std::make_unique<GreetingCache>(greeting_cache_size) : nullptr),
+          server_(port, num_threads, /*num_handler_threads=*/0u, net::AdmissionOptions{}, reuse_port, placement) {
+
+        // Greetings come in bursts of short calls so keep a few requested on every queue
+        net::RpcOptions unary_options{};
+        unary_options.pending_requests = 8u;
+
+        // 'SayHello' is raw so there's no message to put on an arena
+        unary_options.name = "SayHello";
+        server_.register_rpc(&GreeterService::RequestSayHello,
+                             [this](const grpc::ByteBuffer& request, grpc::ByteBuffer* response) {
+                                 return say_hello(request, response);
+                             },
+                             {},
+                             unary_options);
+
+        // A page is only read once the last one has been sent, so a queue never holds more than a page.
+        // Going over would mean the paging is broken, and the client is cut off rather than buffered for.
+        net::SendQueueOptions page_queue{};
+        page_queue.max_queued_messages = max_page_size;
+        page_queue.overflow_policy = net::OverflowPolicy::disconnect;
+
+        net::RpcOptions all_transactions_options{};
+        all_transactions_options.name = "GetAllTransactions";
+        all_transactions_options.send_queue = page_queue;
+
+        server_.register_rpc(net::raw_stream<google::protobuf::Empty, proto::HelloTransaction>(
+                                 &GreeterService::RequestGetAllTransactions),
+                             [this](const google::protobuf::Empty& request,
+                                    net::ServerToClientStream<proto::HelloTransaction>* stream) {
+                                 get_all_transactions(request, stream);
+                             },
+                             {},
+                             all_transactions_options);
+
+        net::RpcOptions transactions_options{};
+        transactions_options.name = "GetTransactions";
+        transactions_options.send_queue = page_queue;
+
+        server_.register_rpc(net::raw_stream<proto::TransactionsRequest, proto::HelloTransaction>(
+                                 &GreeterService::RequestGetTransactions),
+                             [this](const proto::TransactionsRequest& request,
+                                    net::ServerToClientStream<proto::HelloTransaction>* stream) {
+                                 get_transactions(request, stream);
+                             },
+                             {},
+                             transactions_options);
+
+        // Its request and (empty) response only live for the duration of the call
+        unary_options.name = "MaybeSayHello";
+        unary_options.use_arena = true;
+        server_.register_rpc(&proto::Greeter::AsyncService::RequestMaybeSayHello,
+                             [this](const proto::HelloRequest& request, google::protobuf::Empty* response) {
+                                 return maybe_say_hello(request, response);
+                             },
+                             {},
+                             unary_options);
+
+        // Clients that can't keep up with the updates are disconnected rather than buffering forever.
+        // Writes happen while 'mutex_' is held so the policy must not block.
+        net::RpcOptions updates_options{};
+        updates_options.name = "GetTransactionUpdates";
+        updates_options.send_queue.max_queued_messages = 1024u;
+        updates_options.send_queue.overflow_policy = net::OverflowPolicy::disconnect;
+
+        server_.register_rpc(net::raw_stream<google::protobuf::Empty, proto::HelloTransaction>(
+                                 &GreeterService::RequestGetTransactionUpdates),
+                             [this](const google::protobuf::Empty& /*request*/,
+                                    net::ServerToClientStream<proto::HelloTransaction>* stream) {
+                                 std::lock_guard<std::mutex> lock(mutex_);
+                                 client_streams_.emplace(stream);
+                             },
+                             [this](void* stream) {
+                                 std::lock_guard<std::mutex> lock(mutex_);
+                                 auto stream_ptr
+                                     = static_cast<net::ServerToClientStream<proto::HelloTransaction>*>(stream);
+                                 assert(client_streams_.find(stream_ptr) != client_streams_.end());
+                                 client_streams_.erase(stream_ptr);
+                             },
+                             updates_options);
+
+        if (metrics_port != 0u) {
+            metrics_endpoint_ = std::make_unique<net::MetricsEndpoint>(metrics_port, [this] {
+                return net::to_prometheus_text(server_.metrics(), "hello") + log_metrics() + cache_metrics();
+            });
+        }
+    }
+
+    void run() { server_.run(); }
+
+    /**
+     * @brief Refuses new calls and ends the transaction streams cleanly, so subscribers resubscribe
+     *        from their last sequence instead of losing whatever was queued for them.
+     */
+    void drain(std::chrono::milliseconds timeout) { server_.drain(timeout); }
+
+    void shutdown() { server_.shutdown(); }
+
+    net::ServerMetrics metrics() { return server_.metrics(); }
+
+private:
+    // Declared first so the log outlives any stream still holding its mapped records
+    TransactionLog transactions_;
+    std::unique_ptr<GreetingCache> greetings_;
+    net::AsyncServer<proto::Greeter, GreeterService> server_;
+    std::unordered_set<net::ServerToClientStream<proto::HelloTransaction>*> client_streams_;
+
+    // Declared after the server so it stops scraping before the server is destroyed
+    std::unique_ptr<net::MetricsEndpoint> metrics_endpoint_;
+
+    // Guards 'client_streams_'. The log takes appends and reads from every server thread on its own.
+    std::mutex mutex_;
+
+    /**
+     * @brief Answers with the greeting's cached bytes. The request is parsed straight into the transaction,
+     *        but the greeting's message is copied in next to it and the log serializes the whole
+     *        transaction again on every call, cache hit or not.
+     */
+    grpc::Status say_hello(const grpc::ByteBuffer& request_bytes, grpc::ByteBuffer* response) {
+
+        proto::HelloTransaction transaction;
+        try {
+            auto request = net::SerializedMessage<proto::HelloRequest>::from_buffer(request_bytes);
+            request.parse(transaction.mutable_request());
+        } catch (const std::runtime_error& e) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+        }
+        const std::string& name = transaction.request().name();
+
+        std::shared_ptr<const Greeting> greeting
+            = greetings_ ? greetings_->greet(name) : std::make_shared<const Greeting>(name);
+
+        *response = greeting->serialized.buffer();
+        *transaction.mutable_response() = greeting->response;
+
+        return append(std::move(transaction), [](const TransactionLog::Record& /*record*/) {});
+    }
+
+    /**
+     * @brief Appends `transaction` to the log and calls `stored(const TransactionLog::Record&)` with it. A
+     *        failure to store it (e.g. a full disk) finishes the call with an error instead of escaping onto
+     *        the completion queue thread.
+     */
+    template <typename Stored>
+    grpc::Status append(proto::HelloTransaction transaction, Stored&& stored) {
+        try {
+            stored(transactions_.append(std::move(transaction)));
+        } catch (const std::system_error& e) {
+            return grpc::Status(grpc::StatusCode::UNAVAILABLE,
+                                std::string("Failed to store the transaction: ") + e.what());
+        } catch (const std::length_error& e) {
+            return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, e.what());
+        }
+        return grpc::Status::OK;
+    }
+
+    void get_all_transactions(const google::protobuf::Empty& /*request*/,
+                              net::ServerToClientStream<proto::HelloTransaction>* stream) {
+        stream_transactions(/*since_sequence=*/0u, default_page_size, stream);
+    }
+
+    void get_transactions(const proto::TransactionsRequest& request,
+                          net::ServerToClientStream<proto::HelloTransaction>* stream) {
+        std::size_t page_size = request.page_size() == 0u ? default_page_size : request.page_size();
+        if (page_size > max_page_size) {
+            page_size = max_page_size;
+        }
+        stream_transactions(request.since_sequence(), page_size, stream);
+    }
+
+    /**
+     * @brief Sends the log a page at a time, reading the next page once the client has received the
+     *        last one, and finishes the stream when it catches up with the end of the log.
+     */
+    void stream_transactions(std::uint64_t since_sequence,
+                             std::size_t page_size,
+                             net::ServerToClientStream<proto::HelloTransaction>* stream) {
+        stream->on_drained([this, stream, page_size, next_sequence = since_sequence]() mutable {
+            next_sequence = transactions_.read(next_sequence,
+                                               page_size,
+                                               [stream](const TransactionLog::Record& transaction) {
+                                                   stream->write(transaction);
+                                               });
+
+            if (next_sequence >= transactions_.end_sequence()) {
+                stream->finish(grpc::Status::OK);
+            }
+        });
+    }
+
+    // A growing count means transactions are piling up in memory without reaching the disk, and calls
+    // fail until a flush succeeds again
+    std::string log_metrics() const {
+        std::ostringstream out;
+        out << "# TYPE hello_transaction_log_sync_failures_total counter\n"
+            << "hello_transaction_log_sync_failures_total " << transactions_.sync_failures() << '\n';
+        return out.str();
+    }
+
+    std::string cache_metrics() const {
+        if (!greetings_) {
+            return {};
+        }
+        GreetingCacheStats stats = greetings_->stats();
+
+        std::ostringstream out;
+        out << "# TYPE hello_greeting_cache_hits_total counter\n"
+            << "hello_greeting_cache_hits_total " << stats.hits << '\n'
+            << "# TYPE hello_greeting_cache_misses_total counter\n"
+            << "hello_greeting_cache_misses_total " << stats.misses << '\n'
+            << "# TYPE hello_greeting_cache_evictions_total counter\n"
+            << "hello_greeting_cache_evictions_total " << stats.evictions << '\n'
+            << "# TYPE hello_greeting_cache_size gauge\n"
+            << "hello_greeting_cache_size " << stats.size << '\n';
+        return out.str();
+    }
+
+    grpc::Status maybe_say_hello(const proto::HelloRequest& request, google::protobuf::Empty* /*response*/) {
+
+        proto::HelloTransaction transaction;
+        *transaction.mutable_request() = request;
+        build_greeting(request.name(), transaction.mutable_response());
+
+        // Appended under the lock so every update stream gets the transactions in sequence order
+        std::lock_guard<std::mutex> lock(mutex_);
+        return append(std::move(transaction), [this](const TransactionLog::Record& record) {
+            net::broadcast(record, client_streams_);
+        });
+    }
+};
+
+} // namespace hello
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include "testing/temporary_directory.hpp"
+
+#include <grpcpp/create_channel.h>
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+TEST_CASE("[hello] test transaction pages are capped however big a client asks for") {
+    testing::TemporaryDirectory directory;
+    std::size_t max_page_size = hello::HelloServer::max_page_size;
+
+    hello::TransactionLogOptions log_options{};
+    log_options.directory = directory.path;
+    log_options.sync_interval = std::chrono::milliseconds(0);
+
+    // Enough history that an uncapped page would queue several pages' worth at once
+    std::size_t num_transactions = 3u * max_page_size;
+    {
+        hello::TransactionLog log(log_options);
+        for (std::size_t i = 0u; i < num_transactions; ++i) {
+            hello::proto::HelloTransaction transaction;
+            transaction.mutable_request()->set_name(std::to_string(i));
+            log.append(std::move(transaction));
+        }
+    }
+
+    unsigned port = 9090u;
+    hello::HelloServer server(/*port=*/port,
+                              /*num_threads=*/1u,
+                              /*log_options=*/log_options,
+                              /*metrics_port=*/0u,
+                              /*greeting_cache_size=*/0u);
+
+    std::thread run_thread([&server] { server.run(); });
+
+    auto channel = grpc::CreateChannel("0.0.0.0:" + std::to_string(port), grpc::InsecureChannelCredentials());
+    auto stub = hello::proto::Greeter::NewStub(channel);
+
+    grpc::ClientContext context;
+    hello::proto::TransactionsRequest request{};
+    request.set_page_size(std::numeric_limits<std::uint32_t>::max());
+    auto reader = stub->GetTransactions(&context, request);
+
+    std::size_t received = 0u;
+    hello::proto::HelloTransaction transaction;
+    while (reader->Read(&transaction)) {
+        CHECK(transaction.sequence() == received);
+        ++received;
+    }
+    CHECK(reader->Finish().ok());
+    CHECK(received == num_transactions);
+
+    net::ServerMetrics metrics = server.metrics();
+    auto rpc = std::find_if(metrics.rpcs.begin(), metrics.rpcs.end(), [](const net::RpcMetrics& rpc_metrics) {
+        return rpc_metrics.name == "GetTransactions";
+    });
+    REQUIRE(rpc != metrics.rpcs.end());
+    CHECK(rpc->max_stream_queued_messages > 0u);
+    CHECK(rpc->max_stream_queued_messages <= max_page_size);
+
+    server.shutdown();
+    run_thread.join();
+}
+#endif
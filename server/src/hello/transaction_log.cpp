@@ -0,0 +1,727 @@
+#include "transaction_log.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// system
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// standard
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace hello {
+namespace {
+
+/**
+ * @brief Written in front of every record. A header of all zeros marks the end of a segment.
+ */
+struct RecordHeader {
+    std::uint32_t size;
+    std::uint32_t checksum;
+};
+
+constexpr std::size_t header_size = sizeof(RecordHeader);
+constexpr std::size_t sequence_digits = 20u;
+constexpr const char* segment_extension = ".log";
+
+/**
+ * @brief 32 bit FNV-1a. Never 0 for an empty payload so a zeroed header can't pass as a record.
+ */
+std::uint32_t checksum(const char* data, std::size_t size) {
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0u; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+std::system_error system_error(const std::string& what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+std::string segment_name(std::uint64_t first_sequence) {
+    std::ostringstream name;
+    name << std::setw(sequence_digits) << std::setfill('0') << first_sequence << segment_extension;
+    return name.str();
+}
+
+bool is_segment_name(const std::string& name) {
+    std::size_t extension_size = std::strlen(segment_extension);
+
+    if (name.size() != sequence_digits + extension_size
+        || name.compare(sequence_digits, extension_size, segment_extension) != 0) {
+        return false;
+    }
+    return std::all_of(name.begin(), name.begin() + sequence_digits, [](char c) { return c >= '0' && c <= '9'; });
+}
+
+} // namespace
+
+/**
+ * @brief A segment file mapped into memory. The file is created at its full capacity so the mapping
+ *        never has to move while records in it are being read.
+ */
+class TransactionLog::Segment {
+public:
+    Segment(std::string path, std::size_t capacity, bool create);
+    ~Segment();
+
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    char* data() { return data_; }
+    std::size_t capacity() const { return capacity_; }
+
+    // The end of the last record
+    std::size_t size = 0u;
+
+    /**
+     * @brief Throws away everything after `size` so stale bytes can't be mistaken for records later.
+     */
+    void discard_unused();
+
+    /**
+     * @brief Flushes the segment up to `end` to disk.
+     */
+    void sync(std::size_t end);
+
+    /**
+     * @brief Deletes the segment's file. The segment must not be used afterwards.
+     */
+    void remove();
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    char* data_ = nullptr;
+    std::size_t capacity_;
+    std::size_t synced_ = 0u;
+
+    void map();
+    void unmap();
+};
+
+TransactionLog::Segment::Segment(std::string path, std::size_t capacity, bool create)
+    : path_(std::move(path)), capacity_(capacity) {
+
+    fd_ = ::open(path_.c_str(), create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0644);
+    if (fd_ < 0) {
+        throw system_error("Failed to open transaction log segment " + path_);
+    }
+
+    if (create) {
+        if (::ftruncate(fd_, static_cast<off_t>(capacity_)) != 0) {
+            ::close(fd_);
+            throw system_error("Failed to size transaction log segment " + path_);
+        }
+    } else {
+        struct stat file_stat {};
+        if (::fstat(fd_, &file_stat) != 0) {
+            ::close(fd_);
+            throw system_error("Failed to stat transaction log segment " + path_);
+        }
+        capacity_ = static_cast<std::size_t>(file_stat.st_size);
+    }
+
+    try {
+        map();
+    } catch (...) {
+        ::close(fd_);
+        throw;
+    }
+}
+
+TransactionLog::Segment::~Segment() {
+    unmap();
+    ::close(fd_);
+}
+
+void TransactionLog::Segment::discard_unused() {
+    // Shrinking and regrowing the file replaces everything past the records with zeros without
+    // touching the pages
+    unmap();
+    if (::ftruncate(fd_, static_cast<off_t>(size)) != 0 || ::ftruncate(fd_, static_cast<off_t>(capacity_)) != 0) {
+        throw system_error("Failed to truncate transaction log segment " + path_);
+    }
+    map();
+}
+
+void TransactionLog::Segment::sync(std::size_t end) {
+    if (synced_ >= end) {
+        return;
+    }
+
+    auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    std::size_t start = synced_ - synced_ % page_size;
+
+    if (::msync(data_ + start, end - start, MS_SYNC) != 0) {
+        throw system_error("Failed to sync transaction log segment " + path_);
+    }
+    synced_ = end;
+}
+
+void TransactionLog::Segment::remove() {
+    if (::unlink(path_.c_str()) != 0) {
+        throw system_error("Failed to remove transaction log segment " + path_);
+    }
+}
+
+void TransactionLog::Segment::map() {
+    if (capacity_ == 0u) {
+        return;
+    }
+
+    void* mapping = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapping == MAP_FAILED) {
+        throw system_error("Failed to map transaction log segment " + path_);
+    }
+    data_ = static_cast<char*>(mapping);
+}
+
+void TransactionLog::Segment::unmap() {
+    if (data_) {
+        ::munmap(data_, capacity_);
+        data_ = nullptr;
+    }
+}
+
+TransactionLog::TransactionLog(TransactionLogOptions options)
+    : options_(std::move(options)), index_(std::make_unique<std::atomic<IndexEntry*>[]>(max_index_chunks)) {
+    if (options_.directory.empty()) {
+        throw std::invalid_argument("The transaction log needs a directory");
+    }
+    for (std::size_t i = 0u; i < max_index_chunks; ++i) {
+        index_[i].store(nullptr, std::memory_order_relaxed);
+    }
+    recover();
+
+    if (options_.sync_interval.count() != 0) {
+        sync_thread_ = std::thread([this] { sync_periodically(); });
+    }
+}
+
+TransactionLog::~TransactionLog() {
+    if (sync_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(stop_mutex_);
+            stopping_ = true;
+        }
+        stop_requested_.notify_all();
+        sync_thread_.join();
+    }
+
+    try {
+        sync();
+    } catch (const std::system_error&) {
+        // Nothing more can be done about it here
+    }
+}
+
+TransactionLog::Record TransactionLog::append(proto::HelloTransaction transaction) {
+    if (sync_failed_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(sync_error_mutex_);
+        throw std::system_error(sync_error_, "The transaction log can't be flushed to disk");
+    }
+
+    std::uint64_t sequence;
+    std::size_t size;
+    Segment* segment;
+    char* record;
+
+    {
+        std::lock_guard<std::mutex> lock(append_mutex_);
+        sequence = next_sequence_;
+
+        // The sequence number is part of the record so its size isn't known until the number is
+        transaction.set_sequence(sequence);
+
+        size = transaction.ByteSizeLong();
+        if (size > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("Transaction is too large for the transaction log");
+        }
+
+        reserve_index_entry(sequence);
+        segment = &segment_with_room_for(header_size + size);
+
+        record = segment->data() + segment->size;
+        segment->size += header_size + size;
+        ++next_sequence_;
+    }
+
+    char* payload = record + header_size;
+    transaction.SerializeWithCachedSizesToArray(reinterpret_cast<std::uint8_t*>(payload));
+
+    // The header goes in last so a record that was only partly written is never read back
+    RecordHeader header{static_cast<std::uint32_t>(size), checksum(payload, size)};
+    std::memcpy(record, &header, header_size);
+
+    *index_entry(sequence) = {payload, static_cast<std::uint32_t>(size)};
+    publish(sequence, segment, static_cast<std::size_t>(payload + size - segment->data()));
+
+    return Record::from_static_bytes(payload, size);
+}
+
+void TransactionLog::sync() {
+    std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+
+    std::vector<std::pair<Segment*, std::size_t>> segments;
+    std::size_t full_segments;
+    {
+        std::lock_guard<std::mutex> lock(sync_mutex_);
+        segments = full_segments_;
+        full_segments = segments.size();
+        if (last_published_segment_) {
+            segments.emplace_back(last_published_segment_, last_published_end_);
+        }
+    }
+
+    // Published records are never written again so they can be flushed without holding up appends
+    for (const auto& segment : segments) {
+        segment.first->sync(segment.second);
+    }
+
+    // Full segments are only forgotten once they have been flushed, so a failed flush is retried
+    std::lock_guard<std::mutex> lock(sync_mutex_);
+    full_segments_.erase(full_segments_.begin(), full_segments_.begin() + static_cast<std::ptrdiff_t>(full_segments));
+}
+
+void TransactionLog::sync_periodically() {
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+
+    while (!stop_requested_.wait_for(lock, options_.sync_interval, [this] { return stopping_; })) {
+        lock.unlock();
+        try {
+            sync();
+            sync_failed_.store(false, std::memory_order_release);
+        } catch (const std::system_error& e) {
+            sync_failures_.fetch_add(1u, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> error_lock(sync_error_mutex_);
+                sync_error_ = e.code();
+            }
+            sync_failed_.store(true, std::memory_order_release);
+        }
+        lock.lock();
+    }
+}
+
+std::uint64_t TransactionLog::sync_failures() const {
+    return sync_failures_.load(std::memory_order_relaxed);
+}
+
+void TransactionLog::reserve_index_entry(std::uint64_t sequence) {
+    auto chunk = static_cast<std::size_t>(sequence / index_chunk_size);
+
+    if (chunk >= max_index_chunks) {
+        throw std::length_error("The transaction log index is full");
+    }
+    if (!index_[chunk].load(std::memory_order_relaxed)) {
+        index_storage_.emplace_back(std::make_unique<IndexEntry[]>(index_chunk_size));
+        index_[chunk].store(index_storage_.back().get(), std::memory_order_relaxed);
+    }
+}
+
+void TransactionLog::publish(std::uint64_t sequence, Segment* segment, std::size_t end) {
+    // Appenders of earlier records may still be writing them
+    if (published_.load(std::memory_order_acquire) != sequence) {
+        std::unique_lock<std::mutex> lock(publish_mutex_);
+        ++publish_waiters_;
+        published_changed_.wait(lock, [this, sequence] {
+            return published_.load(std::memory_order_acquire) == sequence;
+        });
+        --publish_waiters_;
+    }
+
+    // Every earlier record has been published, so everything before `end` in the segment has been written
+    {
+        std::lock_guard<std::mutex> lock(sync_mutex_);
+
+        // A full segment won't be written to again so the next flush is its last
+        if (last_published_segment_ && last_published_segment_ != segment) {
+            full_segments_.emplace_back(last_published_segment_, last_published_end_);
+        }
+        last_published_segment_ = segment;
+        last_published_end_ = end;
+    }
+
+    bool notify;
+    {
+        std::lock_guard<std::mutex> lock(publish_mutex_);
+        published_.store(sequence + 1u, std::memory_order_release);
+        notify = publish_waiters_ != 0u;
+    }
+    if (notify) {
+        published_changed_.notify_all();
+    }
+}
+
+void TransactionLog::recover() {
+    if (::mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw system_error("Failed to create transaction log directory " + options_.directory);
+    }
+
+    DIR* directory = ::opendir(options_.directory.c_str());
+    if (!directory) {
+        throw system_error("Failed to open transaction log directory " + options_.directory);
+    }
+
+    std::vector<std::string> names;
+    while (dirent* entry = ::readdir(directory)) {
+        if (is_segment_name(entry->d_name)) {
+            names.emplace_back(entry->d_name);
+        }
+    }
+    ::closedir(directory);
+
+    // Zero padded sequence numbers sort in order
+    std::sort(names.begin(), names.end());
+
+    if (!names.empty() && names.front() != segment_name(0u)) {
+        throw std::runtime_error("Transaction log segment " + names.front() + " doesn't start the log");
+    }
+
+    // Records are appended concurrently, so a crash can leave later records (even whole segments) written
+    // after one that never was. The log ends at the first missing or damaged record and nothing after it
+    // is kept.
+    std::size_t kept = 0u;
+    std::uint64_t last_segment_start = 0u;
+
+    while (kept < names.size() && names[kept] == segment_name(next_sequence_)) {
+        segments_.emplace_back(
+            std::make_unique<Segment>(options_.directory + "/" + names[kept], 0u, /*create=*/false));
+        Segment& segment = *segments_.back();
+        ++kept;
+
+        last_segment_start = next_sequence_;
+        segment.size = index_records(&segment, /*verify=*/true);
+
+        // Anything but a zeroed header (or the end of the segment) after the records is a damaged one
+        RecordHeader next{};
+        if (segment.size + header_size <= segment.capacity()) {
+            std::memcpy(&next, segment.data() + segment.size, header_size);
+        }
+        if (next.size != 0u || next.checksum != 0u) {
+            break;
+        }
+    }
+
+    for (std::size_t i = kept; i < names.size(); ++i) {
+        if (::unlink((options_.directory + "/" + names[i]).c_str()) != 0) {
+            throw system_error("Failed to remove transaction log segment " + names[i]);
+        }
+    }
+
+    if (!segments_.empty()) {
+        // The last segment is remapped once whatever follows its records is gone so it has to be indexed again
+        Segment& segment = *segments_.back();
+        next_sequence_ = last_segment_start;
+        segment.discard_unused();
+        index_records(&segment, /*verify=*/false);
+    }
+
+    published_.store(next_sequence_, std::memory_order_release);
+}
+
+std::size_t TransactionLog::index_records(Segment* segment, bool verify) {
+    std::size_t offset = 0u;
+
+    while (offset + header_size <= segment->capacity()) {
+        RecordHeader header{};
+        std::memcpy(&header, segment->data() + offset, header_size);
+
+        const char* payload = segment->data() + offset + header_size;
+
+        if ((header.size == 0u && header.checksum == 0u) || header.size > segment->capacity() - offset - header_size) {
+            break;
+        }
+        if (verify && checksum(payload, header.size) != header.checksum) {
+            break;
+        }
+
+        reserve_index_entry(next_sequence_);
+        *index_entry(next_sequence_) = {payload, header.size};
+        ++next_sequence_;
+        offset += header_size + header.size;
+    }
+    return offset;
+}
+
+TransactionLog::Segment& TransactionLog::segment_with_room_for(std::size_t record_size) {
+    if (!segments_.empty() && segments_.back()->capacity() - segments_.back()->size >= record_size) {
+        return *segments_.back();
+    }
+
+    // An empty segment would have the same name as its replacement. The full segment is flushed once
+    // its last record has been published.
+    if (!segments_.empty() && segments_.back()->size == 0u) {
+        segments_.back()->remove();
+        segments_.pop_back();
+    }
+
+    std::string path = options_.directory + "/" + segment_name(next_sequence_);
+    std::size_t capacity = std::max(options_.segment_size, record_size);
+
+    segments_.emplace_back(std::make_unique<Segment>(std::move(path), capacity, /*create=*/true));
+    return *segments_.back();
+}
+
+} // namespace hello
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include "testing/temporary_directory.hpp"
+
+#include <atomic>
+
+namespace {
+
+using testing::TemporaryDirectory;
+
+hello::proto::HelloTransaction named_transaction(const std::string& name) {
+    hello::proto::HelloTransaction transaction;
+    transaction.mutable_request()->set_name(name);
+    return transaction;
+}
+
+std::vector<std::string> read_names(const hello::TransactionLog& log) {
+    std::vector<std::string> names;
+
+    log.read(0u, log.end_sequence(), [&names](const hello::TransactionLog::Record& record) {
+        std::vector<grpc::Slice> slices;
+        REQUIRE(record.buffer().Dump(&slices).ok());
+        REQUIRE(slices.size() == 1u);
+
+        hello::proto::HelloTransaction transaction;
+        REQUIRE(transaction.ParseFromArray(slices.front().begin(), static_cast<int>(slices.front().size())));
+        CHECK(transaction.sequence() == names.size());
+        names.emplace_back(transaction.request().name());
+    });
+    return names;
+}
+
+} // namespace
+
+TEST_CASE("[hello] test TransactionLog recovers records across segments") {
+    TemporaryDirectory directory;
+
+    hello::TransactionLogOptions options{};
+    options.directory = directory.path;
+    options.segment_size = 64u; // A few records per segment
+
+    std::vector<std::string> names = {"a", "bb", "", "dddddddd", "eeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeee"};
+
+    {
+        hello::TransactionLog log(options);
+        CHECK(log.end_sequence() == 0u);
+
+        for (const auto& name : names) {
+            log.append(named_transaction(name));
+        }
+        CHECK(read_names(log) == names);
+    }
+
+    hello::TransactionLog log(options);
+    CHECK(log.end_sequence() == names.size());
+    CHECK(read_names(log) == names);
+
+    // Appends continue where the recovered log left off
+    CHECK(log.read(names.size(), 1u, [](const hello::TransactionLog::Record&) {}) == names.size());
+    log.append(named_transaction("f"));
+    names.emplace_back("f");
+    CHECK(read_names(log) == names);
+}
+
+TEST_CASE("[hello] test TransactionLog discards an unfinished record") {
+    TemporaryDirectory directory;
+
+    hello::TransactionLogOptions options{};
+    options.directory = directory.path;
+
+    std::size_t end_of_records = 0u;
+    {
+        hello::TransactionLog log(options);
+        end_of_records += hello::header_size + log.append(named_transaction("first")).bytes();
+        end_of_records += hello::header_size + log.append(named_transaction("second")).bytes();
+    }
+
+    // Simulate a crash partway through writing a third record
+    {
+        std::string garbage = "\x05\x00\x00\x00\x01\x02\x03\x04partial";
+        int fd = ::open((directory.path + "/" + hello::segment_name(0u)).c_str(), O_RDWR);
+        REQUIRE(fd >= 0);
+        CHECK(::pwrite(fd, garbage.data(), garbage.size(), static_cast<off_t>(end_of_records))
+              == static_cast<ssize_t>(garbage.size()));
+        ::close(fd);
+    }
+
+    {
+        hello::TransactionLog log(options);
+        CHECK(read_names(log) == std::vector<std::string>{"first", "second"});
+        log.append(named_transaction("third"));
+    }
+
+    hello::TransactionLog log(options);
+    CHECK(read_names(log) == std::vector<std::string>{"first", "second", "third"});
+}
+
+TEST_CASE("[hello] test TransactionLog ends at a record that was never finished in an earlier segment") {
+    TemporaryDirectory directory;
+
+    hello::TransactionLogOptions options{};
+    options.directory = directory.path;
+    options.segment_size = 64u; // A few records per segment
+
+    std::vector<std::string> names = {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j"};
+    {
+        hello::TransactionLog log(options);
+        for (const auto& name : names) {
+            log.append(named_transaction(name));
+        }
+    }
+
+    // Finds where the last record of the first segment starts
+    std::string first_segment = directory.path + "/" + hello::segment_name(0u);
+    std::size_t last_record = 0u;
+    std::size_t first_segment_records = 0u;
+    {
+        int fd = ::open(first_segment.c_str(), O_RDONLY);
+        REQUIRE(fd >= 0);
+
+        hello::RecordHeader header{};
+        std::size_t offset = 0u;
+        while (::pread(fd, &header, hello::header_size, static_cast<off_t>(offset))
+                   == static_cast<ssize_t>(hello::header_size)
+               && header.size != 0u) {
+            last_record = offset;
+            ++first_segment_records;
+            offset += hello::header_size + header.size;
+        }
+        ::close(fd);
+    }
+    std::string second_segment = directory.path + "/" + hello::segment_name(first_segment_records);
+    REQUIRE(::access(second_segment.c_str(), F_OK) == 0);
+
+    // Simulate a crash before that record's header was written while the appenders after it had already
+    // filled in the next segment
+    {
+        hello::RecordHeader unwritten{};
+        int fd = ::open(first_segment.c_str(), O_RDWR);
+        REQUIRE(fd >= 0);
+        CHECK(::pwrite(fd, &unwritten, hello::header_size, static_cast<off_t>(last_record))
+              == static_cast<ssize_t>(hello::header_size));
+        ::close(fd);
+    }
+
+    auto first_lost = names.begin() + static_cast<std::ptrdiff_t>(first_segment_records - 1u);
+    std::vector<std::string> kept(names.begin(), first_lost);
+    {
+        hello::TransactionLog log(options);
+        CHECK(read_names(log) == kept);
+        CHECK(::access(second_segment.c_str(), F_OK) != 0);
+
+        log.append(named_transaction("k"));
+        kept.emplace_back("k");
+    }
+
+    // A damaged record in an earlier segment ends the log the same way
+    {
+        hello::TransactionLog log(options);
+        REQUIRE(read_names(log) == kept);
+
+        for (const auto& name : names) {
+            log.append(named_transaction(name));
+        }
+    }
+    {
+        hello::RecordHeader header{};
+        int fd = ::open(first_segment.c_str(), O_RDWR);
+        REQUIRE(fd >= 0);
+        REQUIRE(::pread(fd, &header, hello::header_size, 0) == static_cast<ssize_t>(hello::header_size));
+        header.checksum ^= 1u;
+        CHECK(::pwrite(fd, &header, hello::header_size, 0) == static_cast<ssize_t>(hello::header_size));
+        ::close(fd);
+    }
+
+    hello::TransactionLog log(options);
+    CHECK(log.end_sequence() == 0u);
+    CHECK(::access(second_segment.c_str(), F_OK) != 0);
+
+    log.append(named_transaction("first"));
+    CHECK(read_names(log) == std::vector<std::string>{"first"});
+}
+
+TEST_CASE("[hello] test TransactionLog appends from several threads while it is read") {
+    TemporaryDirectory directory;
+
+    hello::TransactionLogOptions options{};
+    options.directory = directory.path;
+    options.segment_size = 4096u;
+    options.sync_interval = std::chrono::milliseconds(1); // Flushes while the appends are going
+
+    constexpr int num_threads = 4;
+    constexpr int appends_per_thread = 500;
+
+    std::vector<std::string> names;
+    {
+        hello::TransactionLog log(options);
+        std::atomic_bool appending{true};
+
+        // Every snapshot holds the records before its end in order, however far the appenders have got
+        std::thread reader([&log, &appending] {
+            while (appending) {
+                std::uint64_t expected = 0u;
+                auto check_sequence = [&expected](const hello::TransactionLog::Record& record) {
+                    std::vector<grpc::Slice> slices;
+                    REQUIRE(record.buffer().Dump(&slices).ok());
+
+                    hello::proto::HelloTransaction transaction;
+                    REQUIRE(transaction.ParseFromArray(slices.front().begin(),
+                                                       static_cast<int>(slices.front().size())));
+                    CHECK(transaction.sequence() == expected++);
+                };
+                std::uint64_t end = log.read(0u, log.end_sequence(), check_sequence);
+                CHECK(end == expected);
+            }
+        });
+
+        std::vector<std::thread> appenders;
+        for (int t = 0; t < num_threads; ++t) {
+            appenders.emplace_back([&log, t] {
+                for (int i = 0; i < appends_per_thread; ++i) {
+                    log.append(named_transaction(std::to_string(t) + "-" + std::to_string(i)));
+                }
+            });
+        }
+        for (auto& appender : appenders) {
+            appender.join();
+        }
+        appending = false;
+        reader.join();
+
+        names = read_names(log);
+        CHECK(names.size() == static_cast<std::size_t>(num_threads * appends_per_thread));
+
+        // Each thread's own appends keep their order
+        std::vector<int> next(static_cast<std::size_t>(num_threads), 0);
+        for (const auto& name : names) {
+            auto dash = name.find('-');
+            int thread = std::stoi(name.substr(0u, dash));
+            CHECK(std::stoi(name.substr(dash + 1u)) == next[static_cast<std::size_t>(thread)]++);
+        }
+    }
+
+    hello::TransactionLog recovered(options);
+    CHECK(read_names(recovered) == names);
+}
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+
+// project
+#include "net/serialized_message.hpp"
+
+// generated
+#include <hello/hello.pb.h>
+
+// standard
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace hello {
+
+struct TransactionLogOptions {
+    std::string directory; // Where the segment files are kept. Created if it doesn't exist.
+    std::size_t segment_size = 64u * 1024u * 1024u; // Bytes reserved for each segment file
+    // How often appended records are flushed to disk. The log flushes on a thread of its own so appends
+    // never wait for the disk. 0 leaves flushing to the OS (and `TransactionLog::sync`).
+    std::chrono::milliseconds sync_interval = std::chrono::milliseconds(100);
+};
+
+/**
+ * @brief Every transaction the server has handled, stored on disk so the history survives restarts.
+ *
+ *     Transactions are appended as serialized records to fixed size segment files that stay mapped into
+ *     memory. An index of where each record starts lets readers begin anywhere in the history, and the
+ *     records are handed out as `SerializedMessage`s that point straight at the mapped pages so replaying
+ *     the log never parses or copies a transaction.
+ *
+ *     Opening an existing log maps its segments and walks the record headers to rebuild the index. Every
+ *     record is checked and the log ends just before the first one that is missing or damaged (appends
+ *     run concurrently, so a crash can leave later records written after one that wasn't). Whatever
+ *     follows it, including any later segments, is discarded.
+ *
+ *     Any number of threads can append at once. A record's sequence number and space are reserved under a
+ *     short lock and the record is then serialized into its space without one. Records are published to
+ *     readers in sequence order once every earlier record has been written. Readers never lock: `read`
+ *     and `end_sequence` see exactly the records published before they were called, so iterating over a
+ *     snapshot of the log never holds up appends.
+ */
+class TransactionLog {
+public:
+    using Record = net::SerializedMessage<proto::HelloTransaction>;
+
+    explicit TransactionLog(TransactionLogOptions options);
+    ~TransactionLog();
+
+    TransactionLog(const TransactionLog&) = delete;
+    TransactionLog& operator=(const TransactionLog&) = delete;
+
+    /**
+     * @brief Gives `transaction` the next sequence number and appends it to the log. Returns once the
+     *        record has been published. It reaches the disk with the next flush (see `sync_interval`).
+     * @return the stored record
+     * @throws std::system_error if the last background flush failed, until one succeeds again, so the
+     *         log doesn't keep taking transactions it can't get to the disk
+     */
+    Record append(proto::HelloTransaction transaction);
+
+    /**
+     * @brief Calls `function(const Record&)` for up to `max_count` records in order, starting at
+     *        `since_sequence`. The records stay valid for as long as the log is open.
+     *
+     * @return the sequence number to continue reading from
+     */
+    template <typename Function>
+    std::uint64_t read(std::uint64_t since_sequence, std::size_t max_count, Function&& function) const;
+
+    /**
+     * @brief The number of records that can be read. Appends in progress are not counted.
+     */
+    std::uint64_t end_sequence() const;
+
+    /**
+     * @brief Flushes every published record to disk. Appends carry on while it does.
+     */
+    void sync();
+
+    /**
+     * @brief The number of background flushes that have failed. Each one is retried at the next interval.
+     */
+    std::uint64_t sync_failures() const;
+
+private:
+    class Segment;
+
+    struct IndexEntry {
+        const char* data;
+        std::uint32_t size;
+    };
+
+    // The index is kept in chunks that never move once allocated so readers can use it without a lock
+    static constexpr std::size_t index_chunk_size = 1u << 16u;
+    static constexpr std::size_t max_index_chunks = 1u << 16u;
+
+    TransactionLogOptions options_;
+
+    // Guards reserving sequence numbers, segment space and index chunks
+    std::mutex append_mutex_;
+    std::vector<std::unique_ptr<Segment>> segments_; // The last segment is the one being appended to
+    std::vector<std::unique_ptr<IndexEntry[]>> index_storage_;
+    std::uint64_t next_sequence_ = 0u;
+
+    // A transaction's sequence number is its position in the index
+    std::unique_ptr<std::atomic<IndexEntry*>[]> index_;
+
+    // Records before this one are written and can be read
+    std::atomic<std::uint64_t> published_{0u};
+    std::mutex publish_mutex_;
+    std::condition_variable published_changed_;
+    std::size_t publish_waiters_ = 0u;
+
+    // Guards where the published records end. Only held for long enough to update or copy it.
+    std::mutex sync_mutex_;
+    Segment* last_published_segment_ = nullptr;
+    std::size_t last_published_end_ = 0u; // The end of the last published record in its segment
+    std::vector<std::pair<Segment*, std::size_t>> full_segments_; // Full segments with the end to flush
+
+    // Only one flush runs at a time
+    std::mutex flush_mutex_;
+
+    std::mutex stop_mutex_;
+    std::condition_variable stop_requested_;
+    bool stopping_ = false;
+    std::thread sync_thread_; // Flushes every `sync_interval`
+
+    // Set while the last background flush has failed, with its error kept for appends to fail with
+    std::atomic<bool> sync_failed_{false};
+    std::atomic<std::uint64_t> sync_failures_{0u};
+    std::mutex sync_error_mutex_;
+    std::error_code sync_error_;
+
+    void recover();
+
+    void sync_periodically();
+
+    IndexEntry* index_entry(std::uint64_t sequence) const;
+
+    /**
+     * @brief Makes sure the index has room for `sequence`. Called with `append_mutex_` held.
+     */
+    void reserve_index_entry(std::uint64_t sequence);
+
+    /**
+     * @brief Waits for every earlier record to be published, then publishes the record with `sequence`
+     *        ending at `end` in `segment`.
+     */
+    void publish(std::uint64_t sequence, Segment* segment, std::size_t end);
+
+    /**
+     * @brief Adds the records in `segment` to the index, stopping at the first header that doesn't start
+     *        a record (or whose record fails its checksum when `verify` is set).
+     * @return the end of the last record
+     */
+    std::size_t index_records(Segment* segment, bool verify);
+
+    Segment& segment_with_room_for(std::size_t record_size);
+};
+
+template <typename Function>
+std::uint64_t TransactionLog::read(std::uint64_t since_sequence, std::size_t max_count, Function&& function) const {
+    std::uint64_t end = std::min(end_sequence(), since_sequence + max_count);
+
+    for (std::uint64_t sequence = since_sequence; sequence < end; ++sequence) {
+        const IndexEntry* entry = index_entry(sequence);
+        function(Record::from_static_bytes(entry->data, entry->size));
+    }
+    return std::max(since_sequence, end);
+}
+
+inline std::uint64_t TransactionLog::end_sequence() const {
+    return published_.load(std::memory_order_acquire);
+}
+
+inline TransactionLog::IndexEntry* TransactionLog::index_entry(std::uint64_t sequence) const {
+    // Ordered by the acquire of `published_` that told the caller the record exists
+    IndexEntry* chunk = index_[static_cast<std::size_t>(sequence / index_chunk_size)].load(std::memory_order_relaxed);
+    return chunk + sequence % index_chunk_size;
+}
+
+} // namespace hello
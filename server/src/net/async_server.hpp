@@ -1,15 +1,32 @@
 #pragma once
 
 // project
+#include "net/cpu_affinity.hpp"
+#include "net/queue_delay_shedder.hpp"
 #include "net/server_states.hpp"
+#include "net/server_to_client_stream.hpp"
+#include "net/thread_pool.hpp"
+#include "net/tracer.hpp"
 #include "testing/testing.hpp"
 
 // third-party
+#include <grpc/support/time.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 
 // standard
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 namespace net {
 
@@ -29,15 +46,55 @@ namespace net {
  *     become `mypkg::MyService::AsyncService::RequestMyRpc` when accessing
  *     the functions in C++ land.
  *
+ *     Methods can skip protobuf entirely by marking them raw in the async service:
+ *
+ *     ```cpp
+ *     using RawService = mypkg::MyService::WithRawMethod_MyRpc<mypkg::MyService::AsyncService>;
+ *     AsyncServer<mypkg::MyService, RawService> server(port);
+ *
+ *     server.register_rpc(&RawService::RequestMyRpc,
+ *                         [](const grpc::ByteBuffer& request, grpc::ByteBuffer* response) { ... });
+ *     ```
+ *
+ *     The request then arrives as the bytes the client sent and the response is sent exactly as given,
+ *     so a handler can answer with a cached `SerializedMessage` without encoding anything. The other
+ *     methods keep their typed callbacks.
+ *
+ *     Server and bidirectional streams queue serialized responses. Registered as usual, each response is
+ *     parsed back before gRPC serializes it again. Marking them raw too and registering them with
+ *     `raw_stream` writes the queued bytes as they are and keeps their callbacks typed.
+ *
  * @tparam Service - The gRPC service to use for this server (e.g. mypkg::MyService)
+ * @tparam AsyncService - The generated async service, optionally wrapped in `WithRawMethod_*` classes
  */
-template <typename Service>
+template <typename Service, typename AsyncService = typename Service::AsyncService>
 class AsyncServer {
 public:
-    explicit AsyncServer(unsigned port);
+    /**
+     * @param port - The port the server will listen on
+     * @param num_threads - The number of completion queues to create. Each queue is polled by its own
+     *                      thread and gets its own copy of every registered RPC so connections never
+     *                      share state across queues. Callbacks may be invoked concurrently when this
+     *                      is greater than one.
+     * @param num_handler_threads - The number of threads that run the connect callbacks of RPCs
+     *                              registered with `RpcOptions::offload`. None are created if 0.
+     * @param admission - When new calls are refused to keep the server from being overloaded. Every call
+     *                    is accepted by default.
+     * @param reuse_port - Lets other servers (usually in other processes) listen on the same port, with
+     *                     the kernel spreading new connections between them. Every server sharing the port
+     *                     has to opt in. Clients keep their connection, so a client's calls all go to the
+     *                     same server.
+     * @param placement - Which CPUs the completion queue threads run on. They aren't pinned by default.
+     */
+    explicit AsyncServer(unsigned port,
+                         unsigned num_threads = 1u,
+                         unsigned num_handler_threads = 0u,
+                         const AdmissionOptions& admission = AdmissionOptions{},
+                         bool reuse_port = false,
+                         const PlacementOptions& placement = PlacementOptions{});
 
     /**
-     * @brief This specifies what will happen when a unary rpc call is triggered by the client.
+     * @brief This specifies what will happen when an rpc call is triggered by the client.
      *
      * .............In 'echo.proto'.............
      *
@@ -50,175 +107,913 @@ public:
      *
      * ..............In 'echo.cpp'..............
      *
-     * AsyncServer<echo::Echo> server("0.0.0.0:50051");
+     * AsyncServer<echo::Echo> server(50051);
      *
      * // The callback that will be executed when a client calls 'TestEcho'
-     * auto test_echo_callback = [] (const echo::EchoRequest* request, echo::EchoResponse* response) {
-     *                               *response = request;
-     *                                return grpc::Status::OK;
+     * auto test_echo_callback = [](const echo::EchoRequest& request, echo::EchoResponse* response) {
+     *                               response->set_message(request.message());
+     *                               return grpc::Status::OK;
      *                           };
      *
-     * server.register_unary_rpc(&echo::Echo::AsyncService::RequestTestEcho, test_echo_callback);
+     * server.register_rpc(&echo::Echo::AsyncService::RequestTestEcho, test_echo_callback);
      * .........................................
      *
+     * The callbacks are copied once per completion queue. Each queue's thread sets up its own copy of the
+     * RPC, so its calls are taken once `run` is polling.
+     *
      * @param rpc_function - The unary RPC function
-     * @param callback - What to do when this RPC is triggered <grpc::Status(const Request&, Response*)>
+     * @param callback - What to do when this RPC is triggered. The signature depends on the kind of RPC:
+     *                     unary                <grpc::Status(const Request&, Response*)>
+     *                     deferred unary       <void(const Request&, UnaryResponder<Response>)>
+     *                     server streaming     <void(const Request&, ServerToClientStream<Response>*)>
+     *                     client streaming     <void(ClientToServerStream<Request, Response>*)>
+     *                     bidirectional        <void(BidiStream<Request, Response>*)>
+     *                   Server and bidirectional streams marked raw are registered with `raw_stream`.
+     * @param options - Per-RPC settings (see `RpcOptions`)
      */
     template <typename RpcFunction, typename ConnectCallback, typename DisconnectCallback = detail::EmptyDisconnect>
     void register_rpc(RpcFunction rpc_function,
                       ConnectCallback&& connect_callback,
-                      DisconnectCallback&& disconnect_callback = {});
+                      DisconnectCallback&& disconnect_callback = {},
+                      const RpcOptions& options = RpcOptions{});
 
+    /**
+     * @brief Blocks until the server is shut down. The first completion queue is polled on the calling
+     *        thread and any others are polled on threads owned by this function. When the queues are
+     *        pinned the first one gets its own thread too, so the calling thread isn't pinned.
+     */
     void run();
 
-    void shutdown();
+    /**
+     * @brief Cancels every call that is still in progress and stops the server. `run` returns once
+     *        the cancelled calls have been cleaned up. Deferred unary calls are finished with
+     *        `UNAVAILABLE` without waiting for their `UnaryResponder`s.
+     *
+     *     The calls are cancelled by the threads polling the queues, or by the calling thread when `run`
+     *     isn't polling them (it hasn't been called yet or has already returned). Call it from a thread
+     *     other than the ones polling.
+     *
+     * @param timeout - How long the cancelled calls get to be cleaned up. The queues are shut down once it
+     *                  has passed even if some haven't been, so a call whose events never come back can't
+     *                  keep the server from stopping.
+     */
+    void shutdown(std::chrono::milliseconds timeout = std::chrono::seconds(10));
+
+    /**
+     * @brief Stops the server without cutting calls off mid-stream, then shuts it down.
+     *
+     *     New calls are refused with `UNAVAILABLE`. Server and bidirectional streams are finished with
+     *     `stream_status` as soon as their queued responses have been sent, so long lived subscriptions
+     *     end cleanly and their clients know to resubscribe elsewhere. Unary calls (including deferred
+     *     ones) and client streams get until `timeout` to finish on their own. Whatever is left after
+     *     `timeout` is cancelled, so a stuck client or handler can't hold up a deploy. The cancelled calls
+     *     get as long again to be cleaned up (see `shutdown`).
+     *
+     *     Blocks until the server has stopped. Call it from a thread other than the ones polling.
+     */
+    void drain(std::chrono::milliseconds timeout,
+               const grpc::Status& stream_status = grpc::Status(grpc::StatusCode::UNAVAILABLE,
+                                                                "The server is shutting down"));
+
+    unsigned num_threads() const;
+
+    /**
+     * @brief The connection pool stats for each registered RPC (in the order they were registered),
+     *        summed over all completion queues.
+     */
+    std::vector<ConnectionPoolStats> connection_pool_stats();
+
+    /**
+     * @brief A snapshot of the calls each registered RPC has handled and is handling, summed over all
+     *        completion queues. Cheap enough to be pulled every few seconds while the server is busy.
+     */
+    ServerMetrics metrics();
 
 private:
-    using AsyncService = typename Service::AsyncService;
+    /**
+     * @brief Everything a single completion queue thread touches while processing events.
+     */
+    struct Poller {
+        explicit Poller(const AdmissionOptions& admission)
+            : shedder(admission.target_queue_delay, admission.queue_delay_interval) {}
+
+        std::unique_ptr<grpc::ServerCompletionQueue> queue;
+
+        // Active connections are owned by the connection pool of the RPC call that created them. RPC calls
+        // are only added by the queue's thread and live as long as the server.
+        std::vector<std::unique_ptr<detail::RpcCallHandle<AsyncService>>> rpc_calls;
+
+        // Lets other threads list 'rpc_calls'. The queue's thread only takes it to add an RPC call, never
+        // while it processes an event.
+        std::mutex update_lock;
+
+        // Set once no more connect callbacks may be handed to the handler threads
+        std::atomic<bool> shutting_down{false};
+
+        // Set once new calls are refused
+        std::atomic<bool> draining{false};
+
+        // The CPUs the queue's thread is pinned to. Not pinned if empty.
+        std::vector<unsigned> cpus;
+
+        // Work other threads hand to the queue's thread (adding RPCs, cancelling calls) so nothing the
+        // events touch is shared. 'wakeup' puts 'tasks_tag' on the queue when the first task is added.
+        std::mutex tasks_mutex;
+        std::vector<std::function<void()>> tasks;
+        std::unique_ptr<grpc::Alarm> wakeup;
+        bool accepting_tasks = true; // Cleared right before the queue shuts down
+        bool polling = false;        // Set while the queue's thread is in 'poll'
+        detail::TagCount tasks_count{0u};
+        detail::Tag tasks_tag{detail::TagLabel::poller_tasks, this, &tasks_count};
+
+        // Events taken off the queue. Only counted by the queue's thread so snapshots don't need the lock.
+        std::atomic<std::uint64_t> events{0u};
+
+        // Sheds new calls when events (or this queue's offloaded callbacks) wait too long to be handled.
+        // The probe is a timer whose lateness is how long events currently wait on the queue.
+        QueueDelayShedder shedder;
+        std::unique_ptr<grpc::Alarm> delay_probe;
+        detail::TagCount delay_probe_count{0u};
+        detail::Tag delay_probe_tag{detail::TagLabel::queue_delay_probe, this, &delay_probe_count};
+        std::chrono::steady_clock::time_point delay_probe_deadline;
+    };
+
+    /**
+     * @brief An offloaded connect callback waiting for a handler thread.
+     */
+    struct PendingConnect {
+        std::chrono::system_clock::time_point deadline;
+        std::uint64_t sequence; // Keeps calls with the same deadline in the order they were accepted
+        Poller* poller;
+        detail::RpcCallHandle<AsyncService>* rpc_call;
+        detail::Connection* connection;
+        void* connected_tag;
+    };
+
+    struct LaterDeadline {
+        bool operator()(const PendingConnect& lhs, const PendingConnect& rhs) const {
+            return lhs.deadline != rhs.deadline ? lhs.deadline > rhs.deadline : lhs.sequence > rhs.sequence;
+        }
+    };
+
+    const AdmissionOptions admission_;
+
+    // The bytes queued on every server stream. Declared before the pollers since their connections use it.
+    std::atomic<std::size_t> buffered_stream_bytes_{0u};
 
     std::unique_ptr<AsyncService> service_;
-    std::unique_ptr<grpc::ServerCompletionQueue> server_queue_;
     std::unique_ptr<grpc::Server> server_;
+    std::vector<std::unique_ptr<Poller>> pollers_;
+
+    // Declared after the pollers so it is joined before the connections its tasks use are destroyed
+    std::unique_ptr<ThreadPool> handlers_;
+
+    // Offloaded callbacks run earliest deadline first, so when the handler threads fall behind the calls
+    // about to time out aren't stuck behind ones that can wait
+    std::mutex pending_connects_mutex_;
+    std::priority_queue<PendingConnect, std::vector<PendingConnect>, LaterDeadline> pending_connects_;
+    std::uint64_t next_connect_sequence_ = 0u;
+
+    std::chrono::steady_clock::time_point started_;
+
+    // Counted as soon as 'register_rpc' returns, before the queues' threads have set the RPC up
+    std::atomic<std::size_t> registered_rpcs_{0u};
+
+    void poll(Poller* poller);
+
+    /**
+     * @brief Pins the calling thread to the poller's CPUs, if it has any.
+     */
+    void place(Poller* poller);
+
+    /**
+     * @brief Has the poller's thread run `task` between events.
+     * @return false if the queue is shutting down, in which case `task` is dropped
+     */
+    bool post(Poller* poller, std::function<void()> task);
+
+    /**
+     * @brief Runs `task` on the thread of every poller that still takes tasks and waits for them all.
+     *        Pollers that aren't being polled run it (after the tasks already posted to them) on the
+     *        calling thread instead, so this never waits on a `run` that isn't going on.
+     */
+    void run_on_pollers(const std::function<void(Poller*)>& task);
+
+    /**
+     * @brief Decides whether a call that was just accepted is handled, finishing it with
+     *        `RESOURCE_EXHAUSTED` if it isn't.
+     */
+    bool admit(Poller* poller, detail::RpcCallHandle<AsyncService>* rpc_call, detail::Connection* connection);
+
+    /**
+     * @brief Sets the poller's delay probe to go off a tenth of the queue delay interval from now.
+     *        Only called on the poller's thread.
+     */
+    void schedule_delay_probe(Poller* poller);
 
-    detail::Tagger tagger_;
-    std::unordered_map<void*, std::unique_ptr<detail::RpcCallHandle<AsyncService>>> rpc_calls_;
-    std::unordered_map<void*, std::unique_ptr<detail::Connection>> active_connections_;
-    std::unordered_map<void*, void*> connections_to_rpc_calls_;
+    /**
+     * @brief Queues the connect callback to run on a handler thread, which posts `connected_tag` back to
+     *        the poller's queue once it returns.
+     */
+    void connect_on_handler_thread(Poller* poller,
+                                   detail::RpcCallHandle<AsyncService>* rpc_call,
+                                   detail::Connection* connection);
+
+    /**
+     * @brief Runs the queued connect callback with the earliest deadline. Called once on a handler
+     *        thread for every callback queued.
+     */
+    void run_next_connect();
 
-    std::mutex update_lock_;
+    /**
+     * @brief Closes a connection whose call is done and runs its disconnect callback.
+     * @return the number of the connection's tags still on the queue
+     */
+    static unsigned disconnect(const detail::Tag& tag);
 };
 
-template <typename Service>
-AsyncServer<Service>::AsyncServer(unsigned port) : service_(std::make_unique<AsyncService>()) {
+template <typename Service, typename AsyncService>
+AsyncServer<Service, AsyncService>::AsyncServer(unsigned port,
+                                                unsigned num_threads,
+                                                unsigned num_handler_threads,
+                                                const AdmissionOptions& admission,
+                                                bool reuse_port,
+                                                const PlacementOptions& placement)
+    : admission_(admission), service_(std::make_unique<AsyncService>()), started_(std::chrono::steady_clock::now()) {
+    if (num_threads == 0u) {
+        throw std::invalid_argument("AsyncServer needs at least one thread.");
+    }
+
+    // Checked here since the threads that pin themselves have nowhere to report a failure
+    std::vector<unsigned> allowed = allowed_cpus();
+    for (const auto& cpus : placement.poller_cpus) {
+        if (cpus.empty()) {
+            throw std::invalid_argument("Completion queue threads can't be pinned to no CPUs.");
+        }
+        for (unsigned cpu : cpus) {
+            if (!std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+                throw std::invalid_argument("CPU " + std::to_string(cpu) + " isn't available to the server.");
+            }
+        }
+    }
+
     std::string host_address = "0.0.0.0:" + std::to_string(port);
 
     grpc::ServerBuilder builder;
     builder.RegisterService(service_.get());
     builder.AddListeningPort(host_address, grpc::InsecureServerCredentials());
-    server_queue_ = builder.AddCompletionQueue();
 
-    // Prevent multiple servers from running on the same port
-    builder.AddChannelArgument("grpc.so_reuseport", 0);
+    for (unsigned i = 0u; i < num_threads; ++i) {
+        pollers_.emplace_back(std::make_unique<Poller>(admission));
+        pollers_.back()->queue = builder.AddCompletionQueue();
+
+        if (!placement.poller_cpus.empty()) {
+            pollers_.back()->cpus = placement.poller_cpus[i % placement.poller_cpus.size()];
+        }
+    }
+
+    // Prevent multiple servers from running on the same port unless they all asked to share it
+    builder.AddChannelArgument("grpc.so_reuseport", reuse_port ? 1 : 0);
     server_ = builder.BuildAndStart();
 
     if (!server_) {
         throw std::runtime_error("Failed to build server (might have one running on the same port).");
     }
 
+    if (num_handler_threads > 0u) {
+        handlers_ = std::make_unique<ThreadPool>(num_handler_threads);
+    }
+
     std::cout << "Server running at " << host_address << std::endl;
 }
 
-template <typename Service>
+template <typename Service, typename AsyncService>
 template <typename RpcFunction, typename ConnectCallback, typename DisconnectCallback>
-void AsyncServer<Service>::register_rpc(RpcFunction rpc_function,
+void AsyncServer<Service, AsyncService>::register_rpc(RpcFunction rpc_function,
                                         ConnectCallback&& connect_callback,
-                                        DisconnectCallback&& disconnect_callback) {
+                                        DisconnectCallback&& disconnect_callback,
+                                        const RpcOptions& options) {
+
+    if (options.pending_requests == 0u) {
+        throw std::invalid_argument("RPCs need at least one pending request.");
+    }
+    if (options.offload && !handlers_) {
+        throw std::invalid_argument("Offloaded RPCs need an AsyncServer with at least one handler thread.");
+    }
+
+    using Connect = std::decay_t<ConnectCallback>;
+    using Disconnect = std::decay_t<DisconnectCallback>;
+
+    Connect connect(std::forward<ConnectCallback>(connect_callback));
+    Disconnect disconnect(std::forward<DisconnectCallback>(disconnect_callback));
+
+    auto in_flight = std::make_shared<std::atomic<std::size_t>>(0u);
+
+    // Set up on each queue's thread (once it's pinned) so the RPC call's connections never change hands
+    for (auto& poller : pollers_) {
+        post(poller.get(), [this, poller = poller.get(), rpc_function, connect, disconnect, options, in_flight] {
+            // Requests can't be queued once the queue may be shutting down
+            if (poller->shutting_down) {
+                return;
+            }
+            auto rpc_handle = detail::make_rpc_call_handle<AsyncService>(
+                rpc_function, Connect(connect), Disconnect(disconnect), options);
+            rpc_handle->in_flight = in_flight;
+            rpc_handle->buffered_stream_bytes = &buffered_stream_bytes_;
+            rpc_handle->queue_client_connections(service_.get(), poller->queue.get());
+
+            std::lock_guard<std::mutex> lock(poller->update_lock);
+            poller->rpc_calls.emplace_back(std::move(rpc_handle));
+        });
+    }
+    ++registered_rpcs_;
+}
+
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::run() {
+    std::vector<std::thread> threads;
+    bool pinned = !pollers_.front()->cpus.empty();
+
+    for (auto i = pinned ? 0u : 1u; i < pollers_.size(); ++i) {
+        threads.emplace_back([this, i] {
+            place(pollers_[i].get());
+            poll(pollers_[i].get());
+        });
+    }
+
+    if (!pinned) {
+        poll(pollers_.front().get());
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::place(Poller* poller) {
+    if (!poller->cpus.empty()) {
+        pin_current_thread(poller->cpus);
+    }
+}
+
+template <typename Service, typename AsyncService>
+bool AsyncServer<Service, AsyncService>::post(Poller* poller, std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(poller->tasks_mutex);
+    if (!poller->accepting_tasks) {
+        return false;
+    }
+    poller->tasks.emplace_back(std::move(task));
+
+    // Otherwise the alarm is already set and hasn't been handled yet
+    if (poller->tasks.size() == 1u) {
+        poller->wakeup = std::make_unique<grpc::Alarm>();
+        poller->wakeup->Set(poller->queue.get(),
+                            gpr_now(GPR_CLOCK_MONOTONIC),
+                            detail::Tagger::make_tag(&poller->tasks_tag));
+    }
+    return true;
+}
+
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::run_on_pollers(const std::function<void(Poller*)>& task) {
+    std::mutex mutex;
+    std::condition_variable done;
+    std::size_t remaining = 0u;
+
+    auto run_task = [&](Poller* poller) {
+        task(poller);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        --remaining;
+        done.notify_all();
+    };
 
-    auto rpc_handle = detail::make_rpc_call_handle<AsyncService>(rpc_function,
-                                                                 std::forward<ConnectCallback>(connect_callback),
-                                                                 std::forward<DisconnectCallback>(disconnect_callback));
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto& poller : pollers_) {
+        std::unique_lock<std::mutex> tasks_lock(poller->tasks_mutex);
 
-    rpc_handle->queue_next_client_connection(service_.get(), server_queue_.get(), &tagger_);
+        if (poller->polling || !poller->accepting_tasks) {
+            tasks_lock.unlock();
 
-    void* tag_id = rpc_handle.get();
-    rpc_calls_.emplace(tag_id, std::move(rpc_handle));
+            // Counted under the lock so a task that runs right away can't finish before it's counted
+            if (post(poller.get(), [&run_task, poller = poller.get()] { run_task(poller); })) {
+                ++remaining;
+            }
+            continue;
+        }
+
+        // Holding the tasks lock keeps 'run' from starting to poll the queue meanwhile. The wakeup alarm
+        // stays set and finds no tasks once the queue is polled.
+        std::vector<std::function<void()>> tasks;
+        tasks.swap(poller->tasks);
+        for (auto& posted : tasks) {
+            posted();
+        }
+        task(poller.get());
+    }
+    done.wait(lock, [&remaining] { return remaining == 0u; });
 }
 
-template <typename Service>
-void AsyncServer<Service>::run() {
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::poll(Poller* poller) {
     void* tag_id;
     bool call_ok;
 
-    while (server_queue_->Next(&tag_id, &call_ok)) {
-        std::lock_guard<std::mutex> lock(update_lock_);
+    detail::on_poller_thread() = true;
+
+    {
+        std::lock_guard<std::mutex> lock(poller->tasks_mutex);
+        poller->polling = true;
+    }
+
+    if (admission_.target_queue_delay.count() != 0 && !poller->shutting_down && !poller->delay_probe) {
+        schedule_delay_probe(poller);
+    }
+
+    while (poller->queue->Next(&tag_id, &call_ok)) {
+        poller->events.store(poller->events.load(std::memory_order_relaxed) + 1u, std::memory_order_relaxed);
 
         detail::Tag tag{};
         unsigned tag_count{};
 
-        std::tie(tag, tag_count) = tagger_.get_tag(tag_id);
+        {
+            HELLO_TRACE_SPAN("get_tag", "tagger");
+            std::tie(tag, tag_count) = detail::Tagger::get_tag(tag_id);
+        }
+
+        HELLO_TRACE_SPAN(detail::label_name(tag.label), "queue");
 
         switch (tag.label) {
 
         case detail::TagLabel::rpc_call_requested_by_client:
 
+            // A request only fails when the server is shutting down. The RPC call is left alone because
+            // connections it created may still be on the queue, so it is destroyed with the server.
             if (call_ok) {
-                auto rpc_call = static_cast<detail::RpcCallHandle<AsyncService>*>(tag.data);
-
-                auto active_connection = rpc_call->extract_active_connection();
-
-                // Process the new connection if it hasn't already added itself to the queue (all connections
-                // will have at least one tag on the queue to notify us when the connection is broken).
-                if (tagger_.count(active_connection.get()) == 1u) {
-                    active_connection->add_next_tag_to_queue();
+                auto slot = static_cast<typename detail::RpcCallHandle<AsyncService>::RequestSlot*>(tag.data);
+                auto rpc_call = slot->rpc_call;
+
+                detail::Connection* active_connection = rpc_call->extract_active_connection(slot);
+
+                if (!admit(poller, rpc_call, active_connection)) {
+                    // Refused calls have already been finished with an error and are never started
+                } else if (rpc_call->offload() && !poller->shutting_down) {
+                    connect_on_handler_thread(poller, rpc_call, active_connection);
+                } else {
+                    rpc_call->connect(active_connection);
+
+                    // Give the connection a chance to add itself to the queue if the callback didn't
+                    // already (all connections will have at least one tag on the queue to notify us
+                    // when the connection is broken). Calls refused while connecting are already finished.
+                    if (!active_connection->rejected) {
+                        active_connection->start();
+                    }
                 }
-                void* connection_id = active_connection.get();
-                active_connections_.emplace(connection_id, std::move(active_connection));
-                connections_to_rpc_calls_.emplace(connection_id, rpc_call);
 
-                rpc_call->queue_next_client_connection(service_.get(), server_queue_.get(), &tagger_);
+                rpc_call->queue_next_client_connection(service_.get(), poller->queue.get(), slot);
+            }
+            continue;
+
+        case detail::TagLabel::queue_delay_probe:
+            // Cancelled when the server shuts down
+            if (call_ok) {
+                auto now = std::chrono::steady_clock::now();
+                poller->shedder.observe(std::max(std::chrono::nanoseconds(now - poller->delay_probe_deadline),
+                                                 std::chrono::nanoseconds(0)),
+                                        now);
+            }
+            if (!poller->shutting_down) {
+                schedule_delay_probe(poller);
+            }
+            continue;
 
-            } else if (tag_count == 0) {
-                rpc_calls_.erase(tag_id);
+        case detail::TagLabel::poller_tasks: {
+            std::vector<std::function<void()>> tasks;
+            {
+                std::lock_guard<std::mutex> lock(poller->tasks_mutex);
+                tasks.swap(poller->tasks);
             }
+            for (auto& task : tasks) {
+                task();
+            }
+        }
             continue;
 
-        case detail::TagLabel::processing:
+        case detail::TagLabel::processing: {
+            auto connection = static_cast<detail::Connection*>(tag.data);
             if (call_ok) {
-                auto connection = static_cast<detail::Connection*>(tag.data);
                 connection->add_next_tag_to_queue();
+            } else {
+                connection->processing_failed();
             }
-            break;
+        } break;
+
+        case detail::TagLabel::reading: {
+            auto connection = static_cast<detail::Connection*>(tag.data);
+            connection->read_completed(call_ok);
+        } break;
+
+        case detail::TagLabel::connected: {
+            auto connection = static_cast<detail::Connection*>(tag.data);
+            connection->connecting = false;
+
+            if (connection->finished_while_connecting) {
+                tag_count = disconnect(tag);
+            } else if (!connection->rejected) {
+                connection->start();
+            }
+        } break;
 
         case detail::TagLabel::rpc_finished: {
-            void* rpc_id = connections_to_rpc_calls_.at(tag.data);
-            rpc_calls_.at(rpc_id)->disconnect(tag.data);
+            auto connection = static_cast<detail::Connection*>(tag.data);
+
+            // The callback may still be using the connection so it is disconnected once the callback returns
+            if (connection->connecting) {
+                connection->finished_while_connecting = true;
+                break;
+            }
+            tag_count = disconnect(tag);
         } break;
 
         } // end switch
 
         if (tag_count == 0) {
-            // No more tags with this active_connection are left in the queue so we can delete the data
-            connections_to_rpc_calls_.erase(tag.data);
-            active_connections_.erase(tag.data);
+            // No more tags with this connection are left in the queue so it can be reused
+            auto connection = static_cast<detail::Connection*>(tag.data);
+            connection->owner->recycle(connection);
         }
     }
+
+    std::lock_guard<std::mutex> lock(poller->tasks_mutex);
+    poller->polling = false;
+}
+
+template <typename Service, typename AsyncService>
+bool AsyncServer<Service, AsyncService>::admit(Poller* poller,
+                                               detail::RpcCallHandle<AsyncService>* rpc_call,
+                                               detail::Connection* connection) {
+    grpc::StatusCode code = grpc::StatusCode::RESOURCE_EXHAUSTED;
+    const char* refusal = nullptr;
+
+    if (poller->draining) {
+        code = grpc::StatusCode::UNAVAILABLE;
+        refusal = "The server is shutting down";
+    } else if (connection->expired()) {
+        code = grpc::StatusCode::DEADLINE_EXCEEDED;
+        refusal = "The deadline passed before the call started";
+    } else if (poller->shedder.should_shed()) {
+        refusal = "The server is overloaded";
+    } else if (admission_.max_buffered_stream_bytes != 0u
+               && buffered_stream_bytes_.load(std::memory_order_relaxed) > admission_.max_buffered_stream_bytes) {
+        refusal = "The server has too many responses waiting to be sent";
+    } else if (!rpc_call->reserve_in_flight(connection)) {
+        refusal = "Too many calls of this RPC are in progress";
+    } else {
+        return true;
+    }
+
+    connection->rejected = true;
+    connection->reject(grpc::Status(code, refusal));
+    return false;
+}
+
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::schedule_delay_probe(Poller* poller) {
+    auto period = std::chrono::duration_cast<std::chrono::microseconds>(admission_.queue_delay_interval) / 10;
+
+    poller->delay_probe_deadline = std::chrono::steady_clock::now() + period;
+    poller->delay_probe = std::make_unique<grpc::Alarm>();
+    poller->delay_probe->Set(poller->queue.get(),
+                             gpr_time_add(gpr_now(GPR_CLOCK_MONOTONIC),
+                                          gpr_time_from_micros(period.count(), GPR_TIMESPAN)),
+                             detail::Tagger::make_tag(&poller->delay_probe_tag));
+}
+
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::connect_on_handler_thread(Poller* poller,
+                                                     detail::RpcCallHandle<AsyncService>* rpc_call,
+                                                     detail::Connection* connection) {
+    connection->connecting = true;
+    connection->connected_alarm = std::make_unique<grpc::Alarm>();
+
+    // Counted now so the connection can't be recycled while the callback is running
+    void* connected_tag = detail::Tagger::make_tag(&connection->connected_tag);
+
+    {
+        std::lock_guard<std::mutex> lock(pending_connects_mutex_);
+        pending_connects_.push(PendingConnect{
+            connection->deadline, next_connect_sequence_++, poller, rpc_call, connection, connected_tag});
+    }
+
+    // The task runs whichever callback is most urgent by the time a handler thread is free
+    handlers_->submit([this] { run_next_connect(); });
+}
+
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::run_next_connect() {
+    PendingConnect next{};
+    {
+        std::lock_guard<std::mutex> lock(pending_connects_mutex_);
+        next = pending_connects_.top();
+        pending_connects_.pop();
+    }
+    detail::Connection* connection = next.connection;
+
+    // The time spent waiting for a handler thread counts as queue delay too
+    next.poller->shedder.observe(std::chrono::steady_clock::now() - connection->started);
+
+    if (connection->expired()) {
+        connection->rejected = true;
+        connection->reject(grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED,
+                                        "The deadline passed while the call waited for a handler thread"));
+    } else {
+        next.rpc_call->connect(connection);
+    }
+    connection->connected_alarm->Set(next.poller->queue.get(), gpr_now(GPR_CLOCK_MONOTONIC), next.connected_tag);
+}
+
+template <typename Service, typename AsyncService>
+unsigned AsyncServer<Service, AsyncService>::disconnect(const detail::Tag& tag) {
+    auto connection = static_cast<detail::Connection*>(tag.data);
+    connection->close();
+    connection->owner->disconnect(connection);
+
+    // Another thread may have written to the stream before the disconnect callback
+    // stopped it from doing so, in which case there are new tags on the queue.
+    return detail::Tagger::count(tag);
 }
 
-template <typename Server>
-void AsyncServer<Server>::shutdown() {
-    std::lock_guard<std::mutex> lock(update_lock_);
-    for (auto& connection : active_connections_) {
-        connection.second->cancel();
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::shutdown(std::chrono::milliseconds timeout) {
+    for (auto& poller : pollers_) {
+        poller->shutting_down = true;
     }
+
+    // RPCs registered before this have been set up once it returns, and none are set up after
+    run_on_pollers([](Poller* poller) {
+        if (poller->delay_probe) {
+            poller->delay_probe->Cancel();
+        }
+
+        for (auto& rpc_call : poller->rpc_calls) {
+            rpc_call->cancel_active_connections();
+        }
+    });
     server_->Shutdown();
-    server_queue_->Shutdown();
+
+    // Callbacks that are still running post their connections back to the queues
+    if (handlers_) {
+        handlers_->wait_until_idle();
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    // Calls still waiting on a responder are finished here rather than waited for. No more RPC calls are
+    // added by now and they live as long as the server, so they can be used without the pollers.
+    std::vector<detail::RpcCallHandle<AsyncService>*> rpc_calls;
+    for (auto& poller : pollers_) {
+        std::lock_guard<std::mutex> lock(poller->update_lock);
+        for (auto& rpc_call : poller->rpc_calls) {
+            rpc_calls.emplace_back(rpc_call.get());
+        }
+    }
+    for (auto* rpc_call : rpc_calls) {
+        rpc_call->close_deferred_responses();
+    }
+
+    // gRPC can finish shutting down while cancelled calls still have events on the queues, and handling
+    // them may start new operations (e.g. finishing a client stream whose read failed). Those should all
+    // be done before the queues shut down, but not at the cost of never stopping.
+    for (auto* rpc_call : rpc_calls) {
+        if (!rpc_call->wait_until_inactive(deadline)) {
+            break;
+        }
+    }
+
+    for (auto& poller : pollers_) {
+        {
+            std::lock_guard<std::mutex> lock(poller->tasks_mutex);
+            poller->accepting_tasks = false;
+        }
+        poller->queue->Shutdown();
+    }
+}
+
+template <typename Service, typename AsyncService>
+void AsyncServer<Service, AsyncService>::drain(std::chrono::milliseconds timeout, const grpc::Status& stream_status) {
+    auto deadline = gpr_time_add(gpr_now(GPR_CLOCK_MONOTONIC), gpr_time_from_millis(timeout.count(), GPR_TIMESPAN));
+
+    for (auto& poller : pollers_) {
+        poller->draining = true;
+    }
+
+    run_on_pollers([&stream_status](Poller* poller) {
+        for (auto& rpc_call : poller->rpc_calls) {
+            rpc_call->drain_active_connections(stream_status);
+        }
+    });
+
+    // Stops gRPC from taking new calls and waits for the ones in progress. Any still going at the
+    // deadline are cancelled.
+    server_->Shutdown(deadline);
+
+    shutdown(timeout);
+}
+
+template <typename Service, typename AsyncService>
+unsigned AsyncServer<Service, AsyncService>::num_threads() const {
+    return static_cast<unsigned>(pollers_.size());
+}
+
+template <typename Service, typename AsyncService>
+std::vector<ConnectionPoolStats> AsyncServer<Service, AsyncService>::connection_pool_stats() {
+    std::vector<ConnectionPoolStats> stats;
+
+    for (auto& poller : pollers_) {
+        std::lock_guard<std::mutex> lock(poller->update_lock);
+        stats.resize(std::max(stats.size(), poller->rpc_calls.size()), ConnectionPoolStats{0u, 0u, 0u});
+
+        for (auto i = 0u; i < poller->rpc_calls.size(); ++i) {
+            ConnectionPoolStats rpc_stats = poller->rpc_calls[i]->connection_pool_stats();
+            stats[i].size += rpc_stats.size;
+            stats[i].in_use += rpc_stats.in_use;
+            stats[i].high_water_mark += rpc_stats.high_water_mark;
+        }
+    }
+
+    return stats;
+}
+
+template <typename Service, typename AsyncService>
+ServerMetrics AsyncServer<Service, AsyncService>::metrics() {
+    ServerMetrics metrics{};
+
+    for (auto& poller : pollers_) {
+        // The lock only covers the list of RPC calls. Their counters are atomics, so reading them doesn't
+        // hold up the poller or any of the streams.
+        std::vector<detail::RpcCallHandle<AsyncService>*> rpc_calls;
+        {
+            std::lock_guard<std::mutex> lock(poller->update_lock);
+            for (auto& rpc_call : poller->rpc_calls) {
+                rpc_calls.emplace_back(rpc_call.get());
+            }
+        }
+
+        metrics.completion_queue_events.emplace_back(poller->events.load(std::memory_order_relaxed));
+        metrics.rpcs.resize(std::max({metrics.rpcs.size(), rpc_calls.size(), registered_rpcs_.load()}));
+
+        for (auto i = 0u; i < rpc_calls.size(); ++i) {
+            rpc_calls[i]->add_metrics_to(&metrics.rpcs[i]);
+        }
+    }
+
+    for (auto i = 0u; i < metrics.rpcs.size(); ++i) {
+        if (metrics.rpcs[i].name.empty()) {
+            metrics.rpcs[i].name = "rpc_" + std::to_string(i);
+        }
+    }
+    metrics.uptime = std::chrono::steady_clock::now() - started_;
+    return metrics;
 }
 
 } // namespace net
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
 #include <testing/test_client.hpp>
-#include <thread>
 
-template class net::AsyncServer<testing::proto::Echo>;
+#include <grpcpp/generic/generic_stub.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <numeric>
+#include <unordered_set>
+
+template class net::AsyncServer<testing::proto::Echo, testing::EchoService>;
 
 namespace tp = testing::proto;
-using TestService = tp::Echo::AsyncService;
+using TestService = testing::EchoService;
+using EchoServer = net::AsyncServer<tp::Echo, TestService>;
+
+const auto server_stream_echo
+    = net::raw_stream<tp::EchoRequest, tp::EchoResponse>(&TestService::RequestServerStreamEchoTest);
+const auto bidi_stream_echo = net::raw_stream<tp::EchoRequest, tp::EchoResponse>(&TestService::RequestBidiStreamEchoTest);
 
 TEST_CASE("[net] test servers cannot run on the same port") {
     unsigned port = 9090u;
-    net::AsyncServer<testing::proto::Echo> server(/*port=*/port);
+    EchoServer server(/*port=*/port);
     std::thread run_thread([&server] { server.run(); });
 
-    CHECK_THROWS_AS((net::AsyncServer<testing::proto::Echo>(/*port=*/port)), std::runtime_error);
+    CHECK_THROWS_AS((EchoServer(/*port=*/port)), std::runtime_error);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test servers that reuse the port can share it") {
+    unsigned port = 9090u;
+    std::vector<std::unique_ptr<EchoServer>> servers;
+    std::vector<std::thread> run_threads;
+
+    for (int i = 0; i < 2; ++i) {
+        servers.emplace_back(std::make_unique<EchoServer>(/*port=*/port,
+                                                          /*num_threads=*/1u,
+                                                          /*num_handler_threads=*/0u,
+                                                          net::AdmissionOptions{},
+                                                          /*reuse_port=*/true));
+        servers.back()->register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{});
+    }
+    for (auto& server : servers) {
+        run_threads.emplace_back([&server] { server->run(); });
+    }
+
+    // Servers that didn't opt in still can't take the port
+    CHECK_THROWS_AS((EchoServer(/*port=*/port)), std::runtime_error);
+
+    testing::TestClient client("0.0.0.0:" + std::to_string(port));
+
+    grpc::ClientContext context;
+    tp::EchoRequest request{};
+    request.set_message("shared");
+    tp::EchoResponse response{};
+
+    REQUIRE(client.stub->UnaryEchoTest(&context, request, &response).ok());
+    CHECK(response.message() == "shared");
+
+    for (auto& server : servers) {
+        server->shutdown();
+    }
+    for (auto& run_thread : run_threads) {
+        run_thread.join();
+    }
+}
+
+TEST_CASE("[net] test pinned completion queues set up their RPCs on their own threads") {
+    unsigned port = 9090u;
+    std::vector<unsigned> allowed = net::allowed_cpus();
+    unsigned cpu = allowed.back();
+
+    net::PlacementOptions placement{};
+    placement.poller_cpus = {{cpu}};
+
+    net::PlacementOptions unavailable{};
+    unavailable.poller_cpus = {{static_cast<unsigned>(CPU_SETSIZE)}};
+    CHECK_THROWS_AS((EchoServer(/*port=*/port,
+                                /*num_threads=*/1u,
+                                /*num_handler_threads=*/0u,
+                                net::AdmissionOptions{},
+                                /*reuse_port=*/false,
+                                unavailable)),
+                    std::invalid_argument);
+
+    EchoServer server(/*port=*/port,
+                      /*num_threads=*/2u,
+                      /*num_handler_threads=*/0u,
+                      net::AdmissionOptions{},
+                      /*reuse_port=*/false,
+                      placement);
+
+    std::atomic<int> callback_cpu{-1};
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [&callback_cpu](const tp::EchoRequest& request, tp::EchoResponse* response) {
+                            callback_cpu = sched_getcpu();
+                            return testing::TestService{}(request, response);
+                        });
+
+    // Nothing is allocated until the queue threads are pinned
+    CHECK(server.connection_pool_stats().empty());
+
+    std::vector<unsigned> run_thread_cpus;
+    std::thread run_thread([&server, &run_thread_cpus] {
+        server.run();
+        run_thread_cpus = net::allowed_cpus();
+    });
+
+    testing::TestClient client("0.0.0.0:" + std::to_string(port));
+
+    grpc::ClientContext context;
+    tp::EchoRequest request{};
+    request.set_message("pinned");
+    tp::EchoResponse response{};
+
+    REQUIRE(client.stub->UnaryEchoTest(&context, request, &response).ok());
+    CHECK(response.message() == "pinned");
+    CHECK(callback_cpu == static_cast<int>(cpu));
+
+    std::vector<net::ConnectionPoolStats> stats = server.connection_pool_stats();
+    REQUIRE(stats.size() == 1u);
+    CHECK(stats[0].size >= 1u);
 
     server.shutdown();
     run_thread.join();
+
+    // The thread that called 'run' isn't pinned
+    CHECK(run_thread_cpus == allowed);
 }
 
 TEST_CASE("[net] test server can be stopped immediately with no RPCs") {
     unsigned port = 9090u;
-    net::AsyncServer<testing::proto::Echo> server(/*port=*/port);
+    EchoServer server(/*port=*/port);
 
     std::thread run_thread([&server] { server.run(); });
 
@@ -226,10 +1021,25 @@ TEST_CASE("[net] test server can be stopped immediately with no RPCs") {
     run_thread.join();
 }
 
+TEST_CASE("[net] test server can be shut down without running") {
+    unsigned port = 9090u;
+    EchoServer server(/*port=*/port, /*num_threads=*/2u);
+    server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{});
+
+    server.shutdown();
+
+    // Nothing is set up once the server is shutting down, and running it returns right away
+    CHECK(server.connection_pool_stats().empty());
+    server.run();
+
+    // Shutting down again once 'run' has returned doesn't wait for the pollers either
+    server.shutdown();
+}
+
 TEST_CASE("[net] test single unary rpc call") {
     unsigned port = 9090u;
 
-    net::AsyncServer<testing::proto::Echo> server(/*port=*/port);
+    EchoServer server(/*port=*/port);
 
     server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{});
 
@@ -254,23 +1064,208 @@ TEST_CASE("[net] test single unary rpc call") {
     run_thread.join();
 }
 
-TEST_CASE("[net] test single streaming rpc call") {
+TEST_CASE("[net] test unary rpc call with messages on an arena") {
     unsigned port = 9090u;
 
-    net::AsyncServer<testing::proto::Echo> server(/*port=*/port);
+    EchoServer server(/*port=*/port);
+
+    net::RpcOptions options{};
+    options.use_arena = true;
 
-    server.register_rpc(&TestService::RequestServerStreamEchoTest, testing::TestService{});
+    bool messages_on_arena = false;
+
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [&messages_on_arena](const tp::EchoRequest& request, tp::EchoResponse* response) {
+                            messages_on_arena = request.GetArena() != nullptr
+                                && request.GetArena() == response->GetArena();
+                            return testing::TestService{}(request, response);
+                        },
+                        {},
+                        options);
 
     std::thread run_thread([&server] { server.run(); });
 
     std::string server_address = "0.0.0.0:" + std::to_string(port);
     testing::TestClient client(server_address);
 
-    const char* test_message = "test message";
-    int expected_responses = 12;
+    // Large enough to overflow the arena's inline block
+    std::string test_message(4 * net::detail::call_arena_initial_block_size, 'x');
 
-    grpc::ClientContext context;
-    tp::EchoRequest request{};
+    for (int i = 0; i < 3; ++i) {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_message(test_message);
+        tp::EchoResponse response{};
+
+        grpc::Status status = client.stub->UnaryEchoTest(&context, request, &response);
+
+        REQUIRE(status.ok());
+        CHECK(response.message() == test_message);
+        CHECK(messages_on_arena);
+    }
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test sequential unary rpc calls reuse pooled connections") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    int num_calls = 20;
+
+    for (int i = 0; i < num_calls; ++i) {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_message("test message");
+        tp::EchoResponse response{};
+
+        REQUIRE(client.stub->UnaryEchoTest(&context, request, &response).ok());
+    }
+
+    std::vector<net::ConnectionPoolStats> stats = server.connection_pool_stats();
+    REQUIRE(stats.size() == 1u);
+
+    // One connection waiting for the next client plus any calls still being cleaned up
+    CHECK(stats.front().size <= 4u);
+    CHECK(stats.front().in_use >= 1u);
+    CHECK(stats.front().high_water_mark <= stats.front().size);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test concurrent unary rpc calls on multiple completion queues") {
+    unsigned port = 9090u;
+    unsigned num_threads = 4u;
+
+    EchoServer server(/*port=*/port, num_threads);
+    CHECK(server.num_threads() == num_threads);
+
+    server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+
+    int calls_per_client = 50;
+    std::vector<int> successful_calls(8, 0);
+    std::vector<std::thread> client_threads;
+
+    for (auto c = 0u; c < successful_calls.size(); ++c) {
+        client_threads.emplace_back([&, c] {
+            testing::TestClient client(server_address);
+            std::string test_message = "client " + std::to_string(c);
+
+            for (int i = 0; i < calls_per_client; ++i) {
+                grpc::ClientContext context;
+                tp::EchoRequest request{};
+                request.set_message(test_message);
+                tp::EchoResponse response{};
+
+                grpc::Status status = client.stub->UnaryEchoTest(&context, request, &response);
+
+                if (status.ok() && response.message() == test_message) {
+                    ++successful_calls[c];
+                }
+            }
+        });
+    }
+
+    for (auto& thread : client_threads) {
+        thread.join();
+    }
+
+    for (int count : successful_calls) {
+        CHECK(count == calls_per_client);
+    }
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test pending requests keep several calls requested on each queue") {
+    unsigned port = 9090u;
+    unsigned num_threads = 2u;
+    std::size_t pending_requests = 8u;
+
+    EchoServer server(/*port=*/port, num_threads);
+
+    net::RpcOptions options{};
+    options.pending_requests = pending_requests;
+
+    server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{}, {}, options);
+
+    std::thread run_thread([&server] { server.run(); });
+
+    // Every queue requests its calls as soon as its thread has set the RPC up
+    std::vector<net::ConnectionPoolStats> stats = server.connection_pool_stats();
+    for (int i = 0; i < 100 && (stats.empty() || stats.front().in_use < num_threads * pending_requests); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        stats = server.connection_pool_stats();
+    }
+    REQUIRE(stats.size() == 1u);
+    CHECK(stats.front().in_use == num_threads * pending_requests);
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+
+    std::atomic_int successful_calls{0};
+    std::vector<std::thread> client_threads;
+
+    for (auto c = 0u; c < 2u * pending_requests; ++c) {
+        client_threads.emplace_back([&] {
+            testing::TestClient client(server_address);
+
+            for (int i = 0; i < 10; ++i) {
+                grpc::ClientContext context;
+                tp::EchoResponse response{};
+
+                if (client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response).ok()) {
+                    ++successful_calls;
+                }
+            }
+        });
+    }
+
+    for (auto& thread : client_threads) {
+        thread.join();
+    }
+    CHECK(successful_calls == static_cast<int>(20u * pending_requests));
+
+    options.pending_requests = 0u;
+    CHECK_THROWS_AS(
+        server.register_rpc(server_stream_echo, testing::TestService{}, {}, options),
+        std::invalid_argument);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test single streaming rpc call") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    server.register_rpc(server_stream_echo, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    const char* test_message = "test message";
+    int expected_responses = 12;
+
+    grpc::ClientContext context;
+    tp::EchoRequest request{};
     request.set_message(test_message);
     request.set_expected_responses(expected_responses);
 
@@ -301,12 +1296,12 @@ TEST_CASE("[net] test single streaming rpc call") {
 TEST_CASE("[net] test continuous streaming rpc call returns correct pointer on disconnect") {
     unsigned port = 9090u;
 
-    net::AsyncServer<testing::proto::Echo> server(/*port=*/port);
+    EchoServer server(/*port=*/port);
 
     void* connect_ptr = nullptr;
     void* disconnect_ptr = nullptr;
 
-    server.register_rpc(&TestService::RequestServerStreamEchoTest,
+    server.register_rpc(server_stream_echo,
                         [&connect_ptr](const testing::proto::EchoRequest&,
                                        net::ServerToClientStream<testing::proto::EchoResponse>* stream) {
                             connect_ptr = stream;
@@ -353,4 +1348,1462 @@ TEST_CASE("[net] test continuous streaming rpc call returns correct pointer on d
     grpc::Status status = response_reader->Finish();
     CHECK_FALSE(status.ok());
 }
+namespace {
+
+/**
+ * @brief Registers `callback` for 'ServerStreamEchoTest', reads every response the server sends and
+ *        returns their response numbers along with the final status of the stream.
+ */
+template <typename ConnectCallback>
+std::pair<std::vector<int>, grpc::Status> read_server_stream(const net::RpcOptions& options, ConnectCallback callback) {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+    server.register_rpc(server_stream_echo, callback, {}, options);
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::ClientContext context;
+    std::unique_ptr<grpc::ClientReader<tp::EchoResponse>> response_reader
+        = client.stub->ServerStreamEchoTest(&context, tp::EchoRequest{});
+
+    std::vector<int> response_numbers;
+    tp::EchoResponse response{};
+
+    while (response_reader->Read(&response)) {
+        response_numbers.emplace_back(response.response_number());
+    }
+    grpc::Status status = response_reader->Finish();
+
+    server.shutdown();
+    run_thread.join();
+
+    return std::make_pair(response_numbers, status);
+}
+
+tp::EchoResponse numbered_response(int number) {
+    tp::EchoResponse response{};
+    response.set_message("test message");
+    response.set_response_number(number);
+    return response;
+}
+
+} // namespace
+
+TEST_CASE("[net] test bounded stream drops newest responses") {
+    net::RpcOptions options{};
+    options.send_queue.max_queued_messages = 2u;
+    options.send_queue.overflow_policy = net::OverflowPolicy::drop_newest;
+
+    std::vector<int> response_numbers;
+    grpc::Status status;
+
+    std::tie(response_numbers, status)
+        = read_server_stream(options,
+                             [](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                                 CHECK(stream->write(numbered_response(0)));
+                                 CHECK(stream->write(numbered_response(1)));
+                                 CHECK_FALSE(stream->write(numbered_response(2)));
+                                 CHECK_FALSE(stream->write(numbered_response(3)));
+
+                                 CHECK(stream->queued_messages() == 2u);
+                                 CHECK(stream->queued_bytes()
+                                       == numbered_response(0).ByteSizeLong() + numbered_response(1).ByteSizeLong());
+
+                                 stream->finish(grpc::Status::OK);
+                             });
+
+    CHECK(status.ok());
+    CHECK(response_numbers == std::vector<int>{0, 1});
+}
+
+TEST_CASE("[net] test bounded stream drops oldest unsent responses") {
+    net::RpcOptions options{};
+    options.send_queue.max_queued_messages = 2u;
+    options.send_queue.overflow_policy = net::OverflowPolicy::drop_oldest;
+
+    std::vector<int> response_numbers;
+    grpc::Status status;
+
+    std::tie(response_numbers, status)
+        = read_server_stream(options,
+                             [](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                                 for (int i = 0; i < 5; ++i) {
+                                     CHECK(stream->write(numbered_response(i)));
+                                 }
+                                 stream->finish(grpc::Status::OK);
+                             });
+
+    // The first response was already being written when the others were dropped
+    CHECK(status.ok());
+    CHECK(response_numbers == std::vector<int>{0, 4});
+}
+
+TEST_CASE("[net] test bounded stream disconnects slow clients") {
+    net::RpcOptions options{};
+    options.send_queue.max_queued_bytes = numbered_response(0).ByteSizeLong() + numbered_response(1).ByteSizeLong()
+        + numbered_response(2).ByteSizeLong();
+    options.send_queue.overflow_policy = net::OverflowPolicy::disconnect;
+
+    std::vector<int> response_numbers;
+    grpc::Status status;
+
+    std::tie(response_numbers, status)
+        = read_server_stream(options,
+                             [](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                                 for (int i = 0; i < 3; ++i) {
+                                     CHECK(stream->write(numbered_response(i)));
+                                 }
+                                 CHECK_FALSE(stream->write(numbered_response(3)));
+
+                                 // The stream is closed once the client has been cut off
+                                 CHECK_FALSE(stream->write(numbered_response(4)));
+                                 CHECK(stream->queued_messages() <= 1u);
+                             });
+
+    CHECK_FALSE(status.ok());
+    CHECK(response_numbers.size() <= 1u);
+}
+
+TEST_CASE("[net] test bounded stream blocks producers") {
+    net::RpcOptions options{};
+    options.send_queue.max_queued_messages = 2u;
+    options.send_queue.overflow_policy = net::OverflowPolicy::block_producer;
+
+    int num_responses = 50;
+    std::thread producer;
+
+    std::vector<int> response_numbers;
+    grpc::Status status;
+
+    std::tie(response_numbers, status) = read_server_stream(
+        options,
+        [&producer, num_responses](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+            CHECK(stream->write(numbered_response(0)));
+            CHECK(stream->write(numbered_response(1)));
+
+            // Blocking here would stop the queue from draining so the response is dropped instead
+            CHECK_FALSE(stream->write(numbered_response(-1)));
+
+            producer = std::thread([stream, num_responses] {
+                for (int i = 2; i < num_responses; ++i) {
+                    CHECK(stream->write(numbered_response(i)));
+                    CHECK(stream->queued_messages() <= 2u);
+                }
+                stream->finish(grpc::Status::OK);
+            });
+        });
+
+    producer.join();
+
+    std::vector<int> expected_numbers(static_cast<std::size_t>(num_responses));
+    std::iota(expected_numbers.begin(), expected_numbers.end(), 0);
+
+    CHECK(status.ok());
+    CHECK(response_numbers == expected_numbers);
+}
+
+TEST_CASE("[net] test producers blocked on a cancelled stream return before it is recycled") {
+    unsigned port = 9090u;
+
+    net::RpcOptions options{};
+    options.send_queue.max_queued_messages = 1u;
+    options.send_queue.overflow_policy = net::OverflowPolicy::block_producer;
+
+    // Too big for the client's flow control window so the first write never finishes while it isn't read
+    tp::EchoResponse large_response{};
+    large_response.set_message(std::string(1u << 20u, 'x'));
+
+    std::thread producer;
+    std::atomic_int written{0};
+    std::atomic_bool disconnected{false};
+
+    EchoServer server(/*port=*/port);
+    server.register_rpc(
+        server_stream_echo,
+        [&](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+            producer = std::thread([&, stream] {
+                // Nothing touches the stream once a write has failed
+                while (stream->write(large_response)) {
+                    ++written;
+                }
+            });
+        },
+        [&disconnected](net::ServerToClientStream<tp::EchoResponse>*) { disconnected = true; },
+        options);
+
+    std::thread run_thread([&server] { server.run(); });
+
+    testing::TestClient client("0.0.0.0:" + std::to_string(port));
+
+    grpc::ClientContext context;
+    std::unique_ptr<grpc::ClientReader<tp::EchoResponse>> response_reader
+        = client.stub->ServerStreamEchoTest(&context, tp::EchoRequest{});
+
+    // gRPC buffers a few responses before the producer blocks, which it is when the client gives up
+    int last_written = -1;
+    while (written == 0 || written != last_written) {
+        last_written = written;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    context.TryCancel();
+
+    CHECK_FALSE(response_reader->Finish().ok());
+
+    producer.join();
+    CHECK(written == last_written);
+
+    server.shutdown();
+    run_thread.join();
+
+    CHECK(disconnected);
+}
+
+TEST_CASE("[net] test batched stream writes every response and finishes with the last one") {
+    net::RpcOptions options{};
+    options.write_batch.max_messages = 16u;
+    options.write_batch.max_bytes = 256u;
+
+    int num_responses = 200;
+
+    std::vector<int> response_numbers;
+    grpc::Status status;
+
+    std::tie(response_numbers, status) = read_server_stream(
+        options, [num_responses](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+            for (int i = 0; i < num_responses; ++i) {
+                CHECK(stream->write(numbered_response(i)));
+            }
+            stream->finish(grpc::Status::OK);
+        });
+
+    std::vector<int> expected_numbers(static_cast<std::size_t>(num_responses));
+    std::iota(expected_numbers.begin(), expected_numbers.end(), 0);
+
+    CHECK(status.ok());
+    CHECK(response_numbers == expected_numbers);
+}
+
+TEST_CASE("[net] test stream emplace and write_all queue responses in order") {
+    std::vector<int> response_numbers;
+    grpc::Status status;
+
+    std::tie(response_numbers, status) = read_server_stream(
+        net::RpcOptions{}, [](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+            CHECK(stream->emplace([](tp::EchoResponse& response) { response.set_response_number(0); }));
+
+            // Each emplace fills its own cleared message, so one can be emplaced while another is filled
+            CHECK(stream->emplace([stream](tp::EchoResponse& response) {
+                CHECK(response.response_number() == 0);
+                CHECK(stream->emplace([](tp::EchoResponse& inner) { inner.set_response_number(1); }));
+                CHECK(response.response_number() == 0);
+                response.set_response_number(2);
+            }));
+
+            std::vector<tp::EchoResponse> responses = {numbered_response(3), numbered_response(4)};
+            CHECK(stream->write_all(responses) == 2u);
+
+            std::vector<net::SerializedMessage<tp::EchoResponse>> serialized
+                = {net::SerializedMessage<tp::EchoResponse>(numbered_response(5))};
+            CHECK(stream->write_all(serialized) == 1u);
+
+            stream->finish(grpc::Status::OK);
+        });
+
+    CHECK(status.ok());
+    CHECK(response_numbers == std::vector<int>{0, 1, 2, 3, 4, 5});
+}
+
+TEST_CASE("[net] test stream pulls pages from the drained callback") {
+    int num_responses = 10;
+    int page_size = 3;
+
+    std::vector<int> response_numbers;
+    grpc::Status status;
+
+    std::tie(response_numbers, status) = read_server_stream(
+        net::RpcOptions{},
+        [num_responses, page_size](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+            stream->on_drained([stream, num_responses, page_size, next = 0]() mutable {
+                // Only called once everything from the last page has been sent
+                CHECK(stream->queued_messages() == 0u);
+
+                for (int i = 0; i < page_size && next < num_responses; ++i, ++next) {
+                    CHECK(stream->write(numbered_response(next)));
+                }
+                if (next == num_responses) {
+                    stream->finish(grpc::Status::OK);
+                }
+            });
+        });
+
+    std::vector<int> expected_numbers(static_cast<std::size_t>(num_responses));
+    std::iota(expected_numbers.begin(), expected_numbers.end(), 0);
+
+    CHECK(status.ok());
+    CHECK(response_numbers == expected_numbers);
+}
+
+TEST_CASE("[net] test broadcast writes one serialized response to every stream") {
+    unsigned port = 9090u;
+    std::size_t num_clients = 3u;
+
+    EchoServer server(/*port=*/port, /*num_threads=*/2u);
+
+    std::mutex mutex;
+    std::condition_variable connected;
+    std::unordered_set<net::ServerToClientStream<tp::EchoResponse>*> streams;
+
+    server.register_rpc(server_stream_echo,
+                        [&](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            streams.emplace(stream);
+                            connected.notify_all();
+                        },
+                        [&](void* stream) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            streams.erase(static_cast<net::ServerToClientStream<tp::EchoResponse>*>(stream));
+                        });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    std::vector<std::unique_ptr<grpc::ClientContext>> contexts;
+    std::vector<std::unique_ptr<grpc::ClientReader<tp::EchoResponse>>> readers;
+
+    for (auto i = 0u; i < num_clients; ++i) {
+        contexts.emplace_back(std::make_unique<grpc::ClientContext>());
+        readers.emplace_back(client.stub->ServerStreamEchoTest(contexts.back().get(), tp::EchoRequest{}));
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        connected.wait(lock, [&] { return streams.size() == num_clients; });
+
+        CHECK(net::broadcast(numbered_response(7), streams) == num_clients);
+
+        for (auto* stream : streams) {
+            stream->finish(grpc::Status::OK);
+        }
+    }
+
+    for (auto& reader : readers) {
+        tp::EchoResponse response{};
+        CHECK(reader->Read(&response));
+        CHECK(response.response_number() == 7);
+        CHECK_FALSE(reader->Read(&response));
+        CHECK(reader->Finish().ok());
+    }
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test client streaming rpc call reads every request before responding") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    server.register_rpc(&TestService::RequestClientStreamEchoTest, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    int num_requests = 5;
+
+    grpc::ClientContext context;
+    tp::EchoResponse response{};
+    auto writer = client.stub->ClientStreamEchoTest(&context, &response);
+
+    for (int i = 0; i < num_requests; ++i) {
+        tp::EchoRequest request{};
+        request.set_message("request " + std::to_string(i));
+        REQUIRE(writer->Write(request));
+    }
+    writer->WritesDone();
+
+    REQUIRE(writer->Finish().ok());
+    CHECK(response.message() == "request " + std::to_string(num_requests - 1));
+    CHECK(response.response_number() == num_requests);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test client streaming rpc call holds requests while reading is paused") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    using Stream = net::ClientToServerStream<tp::EchoRequest, tp::EchoResponse>;
+
+    std::mutex mutex;
+    std::condition_variable connected;
+    Stream* paused_stream = nullptr;
+    std::atomic_int requests_read{0};
+
+    server.register_rpc(&TestService::RequestClientStreamEchoTest, [&](Stream* stream) {
+        stream->pause_reading();
+        stream->on_read([&requests_read](const tp::EchoRequest&) { ++requests_read; });
+        stream->on_read_done([&requests_read](tp::EchoResponse* response) {
+            response->set_response_number(requests_read);
+            return grpc::Status::OK;
+        });
+
+        std::lock_guard<std::mutex> lock(mutex);
+        paused_stream = stream;
+        connected.notify_all();
+    });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    int num_requests = 3;
+
+    grpc::ClientContext context;
+    tp::EchoResponse response{};
+    auto writer = client.stub->ClientStreamEchoTest(&context, &response);
+
+    for (int i = 0; i < num_requests; ++i) {
+        REQUIRE(writer->Write(tp::EchoRequest{}));
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        connected.wait(lock, [&] { return paused_stream != nullptr; });
+
+        // Nothing is read until the stream is resumed
+        CHECK(requests_read == 0);
+        paused_stream->resume_reading();
+    }
+    writer->WritesDone();
+
+    REQUIRE(writer->Finish().ok());
+    CHECK(response.response_number() == num_requests);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test bidi streaming rpc call responds while requests are read") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    server.register_rpc(bidi_stream_echo, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::ClientContext context;
+    auto stream = client.stub->BidiStreamEchoTest(&context);
+
+    for (int expected_responses : {2, 3}) {
+        tp::EchoRequest request{};
+        request.set_message("request " + std::to_string(expected_responses));
+        request.set_expected_responses(expected_responses);
+        REQUIRE(stream->Write(request));
+
+        // Each request is answered before the next one is sent
+        for (int i = 0; i < expected_responses; ++i) {
+            tp::EchoResponse response{};
+            REQUIRE(stream->Read(&response));
+            CHECK(response.message() == request.message());
+            CHECK(response.response_number() == i);
+        }
+    }
+    stream->WritesDone();
+
+    tp::EchoResponse response{};
+    CHECK_FALSE(stream->Read(&response));
+    CHECK(stream->Finish().ok());
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test streams not marked raw are registered with their typed functions") {
+    unsigned port = 9090u;
+
+    net::AsyncServer<tp::Echo> server(/*port=*/port);
+
+    server.register_rpc(&tp::Echo::AsyncService::RequestServerStreamEchoTest, testing::TestService{});
+    server.register_rpc(&tp::Echo::AsyncService::RequestBidiStreamEchoTest, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    testing::TestClient client("0.0.0.0:" + std::to_string(port));
+
+    tp::EchoRequest request{};
+    request.set_message("typed");
+    request.set_expected_responses(3);
+
+    {
+        grpc::ClientContext context;
+        auto reader = client.stub->ServerStreamEchoTest(&context, request);
+
+        int i = 0;
+        tp::EchoResponse response{};
+        for (; reader->Read(&response); ++i) {
+            CHECK(response.message() == "typed");
+            CHECK(response.response_number() == i);
+        }
+        CHECK(i == 3);
+        CHECK(reader->Finish().ok());
+    }
+    {
+        grpc::ClientContext context;
+        auto stream = client.stub->BidiStreamEchoTest(&context);
+        REQUIRE(stream->Write(request));
+
+        for (int i = 0; i < 3; ++i) {
+            tp::EchoResponse response{};
+            REQUIRE(stream->Read(&response));
+            CHECK(response.message() == "typed");
+            CHECK(response.response_number() == i);
+        }
+        stream->WritesDone();
+
+        tp::EchoResponse response{};
+        CHECK_FALSE(stream->Read(&response));
+        CHECK(stream->Finish().ok());
+    }
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test offloaded callbacks don't hold up other calls on the same queue") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port, /*num_threads=*/1u, /*num_handler_threads=*/2u);
+
+    std::mutex mutex;
+    std::condition_variable released;
+    bool release = false;
+
+    net::RpcOptions options{};
+    options.offload = true;
+
+    server.register_rpc(
+        &TestService::RequestUnaryEchoTest,
+        [&](const tp::EchoRequest& request, tp::EchoResponse* response) {
+            std::unique_lock<std::mutex> lock(mutex);
+            released.wait(lock, [&release] { return release; });
+            return testing::TestService{}(request, response);
+        },
+        {},
+        options);
+
+    server.register_rpc(server_stream_echo, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::Status slow_status;
+    tp::EchoResponse slow_response{};
+
+    std::thread slow_call([&] {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_message("slow");
+        slow_status = client.stub->UnaryEchoTest(&context, request, &slow_response);
+    });
+
+    // The only completion queue thread keeps handling calls while the slow callback waits
+    for (int i = 0; i < 3; ++i) {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_expected_responses(2);
+
+        auto reader = client.stub->ServerStreamEchoTest(&context, request);
+
+        tp::EchoResponse response{};
+        CHECK(reader->Read(&response));
+        CHECK(reader->Read(&response));
+        CHECK_FALSE(reader->Read(&response));
+        CHECK(reader->Finish().ok());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    released.notify_all();
+    slow_call.join();
+
+    CHECK(slow_status.ok());
+    CHECK(slow_response.message() == "slow");
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test offloaded rpcs need handler threads") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    net::RpcOptions options{};
+    options.offload = true;
+
+    std::thread run_thread([&server] { server.run(); });
+
+    CHECK_THROWS_AS(server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{}, {}, options),
+                    std::invalid_argument);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test deferred unary responses are finished from other threads") {
+    unsigned port = 9090u;
+    std::size_t num_calls = 3u;
+
+    EchoServer server(/*port=*/port);
+
+    std::mutex mutex;
+    std::condition_variable deferred;
+    std::vector<std::pair<tp::EchoRequest, net::UnaryResponder<tp::EchoResponse>>> responders;
+
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [&](const tp::EchoRequest& request, net::UnaryResponder<tp::EchoResponse> responder) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            responders.emplace_back(request, std::move(responder));
+                            deferred.notify_all();
+                        });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    std::vector<grpc::Status> statuses(num_calls);
+    std::vector<tp::EchoResponse> responses(num_calls);
+    std::vector<std::thread> calls;
+
+    for (auto i = 0u; i < num_calls; ++i) {
+        calls.emplace_back([&, i] {
+            grpc::ClientContext context;
+            tp::EchoRequest request{};
+            request.set_message(std::to_string(i));
+            statuses[i] = client.stub->UnaryEchoTest(&context, request, &responses[i]);
+        });
+    }
+
+    // Every call is waiting on a responder at the same time so none of them hold up the queue
+    std::thread finisher([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        deferred.wait(lock, [&] { return responders.size() == num_calls; });
+
+        for (auto& deferred_call : responders) {
+            deferred_call.second.response()->set_message(deferred_call.first.message());
+            deferred_call.second.finish(grpc::Status::OK);
+        }
+        responders.clear();
+    });
+
+    for (auto& call : calls) {
+        call.join();
+    }
+    finisher.join();
+
+    for (auto i = 0u; i < num_calls; ++i) {
+        CHECK(statuses[i].ok());
+        CHECK(responses[i].message() == std::to_string(i));
+    }
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test dropping a deferred unary responder fails the call") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [](const tp::EchoRequest&, net::UnaryResponder<tp::EchoResponse>) {});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::ClientContext context;
+    tp::EchoResponse response{};
+    grpc::Status status = client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response);
+
+    CHECK(status.error_code() == grpc::StatusCode::INTERNAL);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test metrics count each rpc's calls by status code") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port, /*num_threads=*/2u);
+
+    net::RpcOptions options{};
+    options.name = "UnaryEchoTest";
+
+    server.register_rpc(
+        &TestService::RequestUnaryEchoTest,
+        [](const tp::EchoRequest& request, tp::EchoResponse* response) {
+            if (request.message() == "fail") {
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Asked to fail");
+            }
+            response->set_message(request.message());
+            return grpc::Status::OK;
+        },
+        {},
+        options);
+    server.register_rpc(server_stream_echo, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    for (int i = 0; i < 10; ++i) {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_message(i < 3 ? "fail" : "ok");
+        tp::EchoResponse response{};
+        client.stub->UnaryEchoTest(&context, request, &response);
+    }
+
+    // The server sees a call as done a moment after the client gets its status
+    net::ServerMetrics metrics = server.metrics();
+    for (int i = 0; i < 100 && metrics.rpcs[0].calls_finished() < 10u; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        metrics = server.metrics();
+    }
+
+    REQUIRE(metrics.rpcs.size() == 2u);
+    CHECK(metrics.completion_queue_events.size() == 2u);
+
+    const net::RpcMetrics& unary = metrics.rpcs[0];
+    CHECK(unary.name == "UnaryEchoTest");
+    CHECK(unary.calls_started == 10u);
+    CHECK(unary.calls_finished() == 10u);
+    CHECK(unary.calls_in_flight() == 0u);
+    CHECK(unary.errors() == 3u);
+    CHECK(unary.calls_finished_by_code[static_cast<std::size_t>(grpc::StatusCode::INVALID_ARGUMENT)] == 3u);
+    CHECK(unary.latency.count() == 10u);
+
+    CHECK(metrics.rpcs[1].name == "rpc_1");
+    CHECK(metrics.rpcs[1].calls_started == 0u);
+
+    std::uint64_t events = 0u;
+    for (std::uint64_t queue_events : metrics.completion_queue_events) {
+        events += queue_events;
+    }
+    CHECK(events >= 20u);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test calls over an rpc's in flight limit are refused before the callback") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port, /*num_threads=*/2u);
+
+    net::RpcOptions options{};
+    options.max_in_flight = 1u;
+
+    std::mutex mutex;
+    std::condition_variable held;
+    std::vector<net::UnaryResponder<tp::EchoResponse>> responders;
+    std::atomic<int> callbacks{0};
+
+    server.register_rpc(
+        &TestService::RequestUnaryEchoTest,
+        [&](const tp::EchoRequest& request, net::UnaryResponder<tp::EchoResponse> responder) {
+            ++callbacks;
+            if (request.message() != "hold") {
+                responder.finish(grpc::Status::OK);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            responders.emplace_back(std::move(responder));
+            held.notify_all();
+        },
+        {},
+        options);
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    auto call = [&client](const std::string& message) {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_message(message);
+        tp::EchoResponse response{};
+        return client.stub->UnaryEchoTest(&context, request, &response);
+    };
+
+    grpc::Status held_status;
+    std::thread held_call([&] { held_status = call("hold"); });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        held.wait(lock, [&] { return !responders.empty(); });
+    }
+
+    // The limit is shared by both completion queues
+    for (int i = 0; i < 4; ++i) {
+        CHECK(call("refused").error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED);
+    }
+    CHECK(callbacks == 1);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        responders.front().finish(grpc::Status::OK);
+        responders.clear();
+    }
+    held_call.join();
+    CHECK(held_status.ok());
+
+    // The client can get its response before the server has seen the call end
+    while (server.metrics().rpcs.front().calls_in_flight() != 0u) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(call("accepted").ok());
+    CHECK(callbacks == 2);
+
+    net::RpcMetrics metrics = server.metrics().rpcs.front();
+    CHECK(metrics.calls_finished_by_code[static_cast<std::size_t>(grpc::StatusCode::RESOURCE_EXHAUSTED)] == 4u);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test new calls are refused while too many stream bytes are waiting to be sent") {
+    unsigned port = 9090u;
+
+    net::AdmissionOptions admission{};
+    admission.max_buffered_stream_bytes = 1024u * 1024u;
+
+    EchoServer server(/*port=*/port, /*num_threads=*/1u, /*num_handler_threads=*/0u, /*admission=*/admission);
+
+    // Far more than the client's flow control window so the responses wait until they are read
+    server.register_rpc(server_stream_echo,
+                        [](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                            tp::EchoResponse response{};
+                            response.set_message(std::string(1024u * 1024u, 'x'));
+
+                            for (int i = 0; i < 4; ++i) {
+                                stream->write(response);
+                            }
+                            stream->finish(grpc::Status::OK);
+                        });
+    server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    auto unary_call = [&client] {
+        grpc::ClientContext context;
+        tp::EchoResponse response{};
+        return client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response);
+    };
+
+    grpc::ClientContext stream_context;
+    auto reader = client.stub->ServerStreamEchoTest(&stream_context, tp::EchoRequest{});
+
+    while (server.metrics().rpcs.front().queued_bytes <= admission.max_buffered_stream_bytes) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    grpc::Status refused = unary_call();
+    CHECK(refused.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED);
+
+    int responses = 0;
+    tp::EchoResponse response{};
+    while (reader->Read(&response)) {
+        ++responses;
+    }
+    CHECK(reader->Finish().ok());
+    CHECK(responses == 4);
+
+    while (server.metrics().rpcs.front().calls_in_flight() != 0u) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(unary_call().ok());
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test queue delay probes run on every queue until shutdown") {
+    unsigned port = 9090u;
+
+    net::AdmissionOptions admission{};
+    admission.target_queue_delay = std::chrono::milliseconds(50);
+    admission.queue_delay_interval = std::chrono::milliseconds(10);
+
+    EchoServer server(/*port=*/port, /*num_threads=*/2u, /*num_handler_threads=*/0u, /*admission=*/admission);
+    server.register_rpc(&TestService::RequestUnaryEchoTest, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::ClientContext context;
+    tp::EchoResponse response{};
+    CHECK(client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response).ok());
+
+    // An idle queue still measures its delay every millisecond
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (std::uint64_t events : server.metrics().completion_queue_events) {
+        CHECK(events >= 5u);
+    }
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test calls whose deadline passed before they started never reach the callback") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    std::atomic<bool> blocking{false};
+    std::atomic<int> stream_callbacks{0};
+
+    // Holds up the only completion queue thread
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [&blocking](const tp::EchoRequest& request, tp::EchoResponse* response) {
+                            blocking = true;
+                            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                            return testing::TestService{}(request, response);
+                        });
+    server.register_rpc(
+        server_stream_echo,
+        [&stream_callbacks](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+            ++stream_callbacks;
+            stream->finish(grpc::Status::OK);
+        });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    std::thread slow_call([&client] {
+        grpc::ClientContext context;
+        tp::EchoResponse response{};
+        CHECK(client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response).ok());
+    });
+    while (!blocking) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(50));
+
+    auto reader = client.stub->ServerStreamEchoTest(&context, tp::EchoRequest{});
+    tp::EchoResponse response{};
+    CHECK_FALSE(reader->Read(&response));
+    CHECK(reader->Finish().error_code() == grpc::StatusCode::DEADLINE_EXCEEDED);
+
+    slow_call.join();
+
+    while (server.metrics().rpcs[1].calls_finished() == 0u) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(stream_callbacks == 0);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test offloaded callbacks waiting for a handler thread run earliest deadline first") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port, /*num_threads=*/1u, /*num_handler_threads=*/1u);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool blocking = false;
+    bool release = false;
+    std::vector<std::string> order;
+
+    net::RpcOptions options{};
+    options.offload = true;
+
+    server.register_rpc(
+        &TestService::RequestUnaryEchoTest,
+        [&](const tp::EchoRequest& request, tp::EchoResponse* response) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (request.message() == "blocker") {
+                blocking = true;
+                changed.notify_all();
+                changed.wait(lock, [&release] { return release; });
+            } else {
+                order.emplace_back(request.message());
+            }
+            return testing::TestService{}(request, response);
+        },
+        {},
+        options);
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    auto call = [&client](const std::string& message, std::chrono::seconds timeout) {
+        grpc::ClientContext context;
+        if (timeout.count() != 0) {
+            context.set_deadline(std::chrono::system_clock::now() + timeout);
+        }
+        tp::EchoRequest request{};
+        request.set_message(message);
+        tp::EchoResponse response{};
+        CHECK(client.stub->UnaryEchoTest(&context, request, &response).ok());
+    };
+
+    std::vector<std::thread> calls;
+    calls.emplace_back(call, "blocker", std::chrono::seconds(0));
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&blocking] { return blocking; });
+    }
+
+    // Accepted one at a time while the only handler thread is busy
+    std::vector<std::pair<std::string, std::chrono::seconds>> waiting
+        = {{"10s", std::chrono::seconds(10)}, {"5s", std::chrono::seconds(5)}, {"none", std::chrono::seconds(0)}};
+    waiting.emplace_back("2s", std::chrono::seconds(2));
+
+    for (auto i = 0u; i < waiting.size(); ++i) {
+        calls.emplace_back(call, waiting[i].first, waiting[i].second);
+
+        while (server.metrics().rpcs.front().calls_started < i + 2u) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    changed.notify_all();
+
+    for (auto& thread : calls) {
+        thread.join();
+    }
+    CHECK(order == std::vector<std::string>{"2s", "5s", "10s", "none"});
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test streams stop taking responses once the client's deadline has passed") {
+    std::atomic<bool> done{false};
+    bool wrote = true;
+    std::size_t queued = 1u;
+
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+    server.register_rpc(server_stream_echo,
+                        [&](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(150));
+
+                            wrote = stream->write(numbered_response(0));
+                            queued = stream->queued_messages();
+                            stream->finish(grpc::Status::OK);
+                            done = true;
+                        });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(50));
+
+    auto reader = client.stub->ServerStreamEchoTest(&context, tp::EchoRequest{});
+    tp::EchoResponse response{};
+    CHECK_FALSE(reader->Read(&response));
+    CHECK(reader->Finish().error_code() == grpc::StatusCode::DEADLINE_EXCEEDED);
+
+    while (!done) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_FALSE(wrote);
+    CHECK(queued == 0u);
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test draining ends streams cleanly and lets unary calls finish") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<net::UnaryResponder<tp::EchoResponse>> responders;
+    bool subscribed = false;
+
+    // A subscription that only ends when the server does
+    server.register_rpc(server_stream_echo,
+                        [&](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                            for (int i = 0; i < 3; ++i) {
+                                stream->write(numbered_response(i));
+                            }
+                            std::lock_guard<std::mutex> lock(mutex);
+                            subscribed = true;
+                            changed.notify_all();
+                        });
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [&](const tp::EchoRequest&, net::UnaryResponder<tp::EchoResponse> responder) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            responders.emplace_back(std::move(responder));
+                            changed.notify_all();
+                        });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::ClientContext stream_context;
+    auto reader = client.stub->ServerStreamEchoTest(&stream_context, tp::EchoRequest{});
+
+    grpc::Status unary_status;
+    std::thread unary_call([&] {
+        grpc::ClientContext context;
+        tp::EchoResponse response{};
+        unary_status = client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response);
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return subscribed && !responders.empty(); });
+    }
+
+    std::thread drain_thread([&server] { server.drain(std::chrono::seconds(5)); });
+
+    // The deferred call is still answered after the server started draining
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        responders.front().finish(grpc::Status::OK);
+        responders.clear();
+    }
+    unary_call.join();
+    CHECK(unary_status.ok());
+
+    std::vector<int> response_numbers;
+    tp::EchoResponse response{};
+    while (reader->Read(&response)) {
+        response_numbers.emplace_back(response.response_number());
+    }
+    grpc::Status stream_status = reader->Finish();
+
+    CHECK(response_numbers == std::vector<int>{0, 1, 2});
+    CHECK(stream_status.error_code() == grpc::StatusCode::UNAVAILABLE);
+    CHECK(stream_status.error_message() == "The server is shutting down");
+
+    drain_thread.join();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test draining cancels the calls still going at the timeout") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+    server.register_rpc(&TestService::RequestClientStreamEchoTest, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    // The client never says it is done writing
+    grpc::ClientContext context;
+    tp::EchoResponse response{};
+    auto writer = client.stub->ClientStreamEchoTest(&context, &response);
+    REQUIRE(writer->Write(tp::EchoRequest{}));
+
+    // Calls gRPC hasn't handed to the server yet are cancelled right away
+    while (server.metrics().rpcs.front().calls_started == 0u) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    server.drain(std::chrono::milliseconds(100));
+    run_thread.join();
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(elapsed >= std::chrono::milliseconds(100));
+    CHECK(elapsed < std::chrono::seconds(2));
+    CHECK_FALSE(writer->Finish().ok());
+}
+
+TEST_CASE("[net] test draining doesn't wait for a deferred responder that never finishes") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    std::mutex mutex;
+    std::condition_variable deferred;
+    std::vector<net::UnaryResponder<tp::EchoResponse>> responders;
+
+    // The responders are kept but never finished, like a handler stuck on a dependency
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [&](const tp::EchoRequest&, net::UnaryResponder<tp::EchoResponse> responder) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            responders.emplace_back(std::move(responder));
+                            deferred.notify_all();
+                        });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::Status status;
+    std::thread call([&] {
+        grpc::ClientContext context;
+        tp::EchoResponse response{};
+        status = client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response);
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        deferred.wait(lock, [&] { return !responders.empty(); });
+        CHECK_FALSE(responders.front().cancelled());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    server.drain(std::chrono::milliseconds(100));
+    run_thread.join();
+    call.join();
+
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    CHECK_FALSE(status.ok());
+
+    // The handler finds out it can give up and finishing late does nothing
+    REQUIRE(responders.size() == 1u);
+    CHECK(responders.front().cancelled());
+    responders.front().response()->set_message("late");
+    responders.front().finish(grpc::Status::OK);
+}
+
+TEST_CASE("[net] test deferred responders see their client give up") {
+    unsigned port = 9090u;
+
+    EchoServer server(/*port=*/port);
+
+    std::mutex mutex;
+    std::condition_variable deferred;
+    std::vector<net::UnaryResponder<tp::EchoResponse>> responders;
+
+    server.register_rpc(&TestService::RequestUnaryEchoTest,
+                        [&](const tp::EchoRequest&, net::UnaryResponder<tp::EchoResponse> responder) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            responders.emplace_back(std::move(responder));
+                            deferred.notify_all();
+                        });
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(200));
+    tp::EchoResponse response{};
+    grpc::Status status = client.stub->UnaryEchoTest(&context, tp::EchoRequest{}, &response);
+    CHECK(status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED);
+
+    // The server notices a moment after the client does
+    net::UnaryResponder<tp::EchoResponse>* responder = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        REQUIRE(responders.size() == 1u);
+        responder = &responders.front();
+    }
+    for (int i = 0; i < 100 && !responder->cancelled(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(responder->cancelled());
+
+    server.shutdown();
+    run_thread.join();
+}
+
+TEST_CASE("[net] test raw unary rpc answers with pre-serialized bytes") {
+    using RawService = tp::Echo::WithRawMethod_UnaryEchoTest<TestService>;
+
+    unsigned port = 9090u;
+    net::AsyncServer<tp::Echo, RawService> server(/*port=*/port);
+
+    tp::EchoResponse canned_response{};
+    canned_response.set_message("canned");
+    net::SerializedMessage<tp::EchoResponse> canned(canned_response);
+
+    // Raw messages aren't protobufs so they stay off the arena
+    net::RpcOptions options{};
+    options.use_arena = true;
+
+    server.register_rpc(
+        &RawService::RequestUnaryEchoTest,
+        [&canned](const grpc::ByteBuffer& request, grpc::ByteBuffer* response) {
+            tp::EchoRequest parsed = net::SerializedMessage<tp::EchoRequest>::from_buffer(request).parse();
+            if (parsed.message() != "canned") {
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Only canned responses");
+            }
+            *response = canned.buffer();
+            return grpc::Status::OK;
+        },
+        {},
+        options);
+
+    // The handlers of raw streams are still typed
+    server.register_rpc(server_stream_echo, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
+    testing::TestClient client(server_address);
+
+    for (const char* message : {"canned", "fresh"}) {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_message(message);
+        tp::EchoResponse response{};
+
+        grpc::Status status = client.stub->UnaryEchoTest(&context, request, &response);
+
+        if (std::string(message) == "canned") {
+            REQUIRE(status.ok());
+            CHECK(response.message() == "canned");
+        } else {
+            CHECK(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+        }
+    }
+
+    {
+        grpc::ClientContext context;
+        tp::EchoRequest request{};
+        request.set_message("typed");
+        request.set_expected_responses(2);
+
+        auto reader = client.stub->ServerStreamEchoTest(&context, request);
+        tp::EchoResponse response{};
+        int responses = 0;
+        while (reader->Read(&response)) {
+            CHECK(response.message() == "typed");
+            ++responses;
+        }
+        CHECK(reader->Finish().ok());
+        CHECK(responses == 2);
+    }
+
+    server.shutdown();
+    run_thread.join();
+}
+
+namespace {
+
+/**
+ * @brief Sends `request` as the only message of a call to `method` and returns the call's status. The
+ *        bytes are sent as they are, whatever the method's request type.
+ */
+grpc::Status call_with_bytes(const std::shared_ptr<grpc::Channel>& channel,
+                             const std::string& method,
+                             const grpc::ByteBuffer& request) {
+    grpc::GenericStub stub(channel);
+    grpc::CompletionQueue queue;
+    grpc::ClientContext context;
+
+    void* tag;
+    bool ok;
+    auto next = [&queue, &tag, &ok] { REQUIRE(queue.Next(&tag, &ok)); };
+
+    std::unique_ptr<grpc::GenericClientAsyncReaderWriter> call = stub.PrepareCall(&context, method, &queue);
+    call->StartCall(nullptr);
+    next();
+    call->Write(request, nullptr);
+    next();
+    call->WritesDone(nullptr);
+    next();
+
+    grpc::ByteBuffer response;
+    call->Read(&response, nullptr);
+    next();
+
+    grpc::Status status;
+    call->Finish(&status, nullptr);
+    next();
+
+    queue.Shutdown();
+    while (queue.Next(&tag, &ok)) {
+    }
+    return status;
+}
+
+} // namespace
+
+TEST_CASE("[net] test raw streams refuse requests that don't parse") {
+    unsigned port = 9090u;
+
+    std::atomic_int connects{0};
+
+    EchoServer server(/*port=*/port);
+    server.register_rpc(server_stream_echo,
+                        [&connects](const tp::EchoRequest&, net::ServerToClientStream<tp::EchoResponse>* stream) {
+                            ++connects;
+                            stream->finish(grpc::Status::OK);
+                        });
+    server.register_rpc(bidi_stream_echo, testing::TestService{});
+
+    std::thread run_thread([&server] { server.run(); });
+
+    testing::TestClient client("0.0.0.0:" + std::to_string(port));
+
+    // A field tag that never ends
+    std::string garbage = "\xff\xff\xff";
+    grpc::Slice slice(garbage);
+    grpc::ByteBuffer request(&slice, 1u);
+
+    grpc::Status status = call_with_bytes(client.channel, "/testing.proto.Echo/ServerStreamEchoTest", request);
+    CHECK(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+    CHECK(connects == 0);
+
+    status = call_with_bytes(client.channel, "/testing.proto.Echo/BidiStreamEchoTest", request);
+    CHECK(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+
+    server.shutdown();
+    run_thread.join();
+
+    // Refused calls are still counted
+    CHECK(server.metrics().rpcs.front().calls_started == 1u);
+}
 #endif
@@ -0,0 +1,97 @@
+#pragma once
+
+// project
+#include "testing/testing.hpp"
+
+// third-party
+#include <google/protobuf/arena.h>
+#include <google/protobuf/message_lite.h>
+
+// standard
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace net {
+namespace detail {
+
+/**
+ * @brief The size of the block each call arena starts with. Messages that need more than this
+ *        fall back to allocating additional blocks for the rest of the call.
+ */
+constexpr std::size_t call_arena_initial_block_size = 1024u;
+
+/**
+ * @brief A protobuf arena for the messages of a single call. The arena's first block is stored
+ *        inline so a pooled connection can create and destroy its arena for every call without
+ *        touching the heap.
+ */
+class CallArena {
+public:
+    CallArena();
+    ~CallArena();
+
+    CallArena(const CallArena&) = delete;
+    CallArena& operator=(const CallArena&) = delete;
+
+    google::protobuf::Arena* arena();
+
+private:
+    alignas(std::max_align_t) char initial_block_[call_arena_initial_block_size];
+    google::protobuf::Arena arena_;
+
+    static google::protobuf::ArenaOptions make_options(char* initial_block);
+};
+
+inline CallArena::CallArena() : arena_(make_options(initial_block_)) {}
+
+inline CallArena::~CallArena() = default;
+
+inline google::protobuf::Arena* CallArena::arena() {
+    return &arena_;
+}
+
+inline google::protobuf::ArenaOptions CallArena::make_options(char* initial_block) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = initial_block;
+    options.initial_block_size = call_arena_initial_block_size;
+    return options;
+}
+
+/**
+ * @brief Used in place of `CallArena` when messages should use the heap.
+ */
+struct NoCallArena {
+    google::protobuf::Arena* arena() { return nullptr; }
+};
+
+/**
+ * @brief A message that lives on `arena` if one is given or inline otherwise. Messages of raw methods
+ *        (`grpc::ByteBuffer`) aren't protobufs and are always inline.
+ */
+template <typename Message>
+class CallMessage {
+public:
+    explicit CallMessage(google::protobuf::Arena* arena)
+        : message_(create(arena, std::is_base_of<google::protobuf::MessageLite, Message>{})) {}
+
+    CallMessage(const CallMessage&) = delete;
+    CallMessage& operator=(const CallMessage&) = delete;
+
+    Message* get() { return message_; }
+    Message& operator*() { return *message_; }
+    Message* operator->() { return message_; }
+
+private:
+    Message inline_message_;
+    Message* message_;
+
+    Message* create(google::protobuf::Arena* arena, std::true_type /*protobuf*/) {
+        return arena ? google::protobuf::Arena::CreateMessage<Message>(arena) : &inline_message_;
+    }
+
+    Message* create(google::protobuf::Arena* /*arena*/, std::false_type /*protobuf*/) { return &inline_message_; }
+};
+
+} // namespace detail
+} // namespace net
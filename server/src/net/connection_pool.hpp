@@ -0,0 +1,192 @@
+#pragma once
+
+// project
+#include "testing/testing.hpp"
+
+// standard
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace net {
+
+struct ConnectionPoolStats {
+    std::size_t size; // The number of connection objects the pool has allocated storage for
+    std::size_t in_use; // The number of those objects currently handed out
+    std::size_t high_water_mark; // The most objects that have been in use at once
+};
+
+namespace detail {
+
+/**
+ * @brief Hands out objects constructed in storage that is kept around after the objects are released,
+ *        so once the pool has grown to the number of concurrent connections no more memory is allocated.
+ *
+ *     gRPC objects like `grpc::ServerContext` can't be reset, so released objects are destroyed and new
+ *     ones are constructed in their place on the next `acquire`.
+ *
+ *     Not thread safe. Each pool belongs to a single completion queue thread.
+ *
+ * @tparam T - The type of object being pooled
+ */
+template <typename T>
+class ConnectionPool {
+public:
+    ConnectionPool() = default;
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    template <typename... Args>
+    T* acquire(Args&&... args);
+
+    void release(T* object);
+
+    /**
+     * @brief Calls `function(T*)` for every object that has been acquired but not released.
+     */
+    template <typename Function>
+    void for_each_in_use(Function&& function);
+
+    /**
+     * @brief Can be called from any thread, unlike everything else.
+     */
+    ConnectionPoolStats stats() const;
+
+private:
+    struct Slot {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        Slot* next_free = nullptr;
+        bool in_use = false;
+    };
+
+    static_assert(std::is_standard_layout<Slot>::value, "The object must be at the start of a Slot");
+
+    std::vector<std::unique_ptr<Slot>> slots_;
+    Slot* free_list_ = nullptr;
+
+    // Only changed by the thread using the pool, so they are stored rather than incremented
+    std::atomic<std::size_t> size_{0u};
+    std::atomic<std::size_t> in_use_{0u};
+    std::atomic<std::size_t> high_water_mark_{0u};
+};
+
+template <typename T>
+ConnectionPool<T>::~ConnectionPool() {
+    for_each_in_use([](T* object) { object->~T(); });
+}
+
+template <typename T>
+template <typename... Args>
+T* ConnectionPool<T>::acquire(Args&&... args) {
+    Slot* slot = free_list_;
+
+    if (slot) {
+        free_list_ = slot->next_free;
+    } else {
+        slots_.emplace_back(std::make_unique<Slot>());
+        slot = slots_.back().get();
+        size_.store(slots_.size(), std::memory_order_relaxed);
+    }
+
+    T* object = new (&slot->storage) T(std::forward<Args>(args)...);
+    slot->in_use = true;
+
+    std::size_t in_use = in_use_.load(std::memory_order_relaxed) + 1u;
+    in_use_.store(in_use, std::memory_order_relaxed);
+    if (in_use > high_water_mark_.load(std::memory_order_relaxed)) {
+        high_water_mark_.store(in_use, std::memory_order_relaxed);
+    }
+
+    return object;
+}
+
+template <typename T>
+void ConnectionPool<T>::release(T* object) {
+    auto slot = reinterpret_cast<Slot*>(object);
+
+    object->~T();
+    slot->in_use = false;
+    slot->next_free = free_list_;
+    free_list_ = slot;
+
+    in_use_.store(in_use_.load(std::memory_order_relaxed) - 1u, std::memory_order_relaxed);
+}
+
+template <typename T>
+template <typename Function>
+void ConnectionPool<T>::for_each_in_use(Function&& function) {
+    for (auto& slot : slots_) {
+        if (slot->in_use) {
+            function(reinterpret_cast<T*>(&slot->storage));
+        }
+    }
+}
+
+template <typename T>
+ConnectionPoolStats ConnectionPool<T>::stats() const {
+    return {size_.load(std::memory_order_relaxed),
+            in_use_.load(std::memory_order_relaxed),
+            high_water_mark_.load(std::memory_order_relaxed)};
+}
+
+} // namespace detail
+} // namespace net
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+namespace {
+
+struct PooledObject {
+    int* alive;
+    int value;
+
+    PooledObject(int* a, int v) : alive(a), value(v) { ++*alive; }
+    ~PooledObject() { --*alive; }
+};
+
+} // namespace
+
+TEST_CASE("[net] test ConnectionPool reuses released objects") {
+    int alive = 0;
+
+    {
+        net::detail::ConnectionPool<PooledObject> pool;
+
+        PooledObject* first = pool.acquire(&alive, 1);
+        PooledObject* second = pool.acquire(&alive, 2);
+
+        CHECK(alive == 2);
+        CHECK(first->value == 1);
+        CHECK(second->value == 2);
+        CHECK(pool.stats().size == 2u);
+        CHECK(pool.stats().in_use == 2u);
+        CHECK(pool.stats().high_water_mark == 2u);
+
+        pool.release(first);
+        CHECK(alive == 1);
+        CHECK(pool.stats().in_use == 1u);
+
+        // The released storage is handed back out instead of growing the pool
+        PooledObject* third = pool.acquire(&alive, 3);
+        CHECK(third == first);
+        CHECK(third->value == 3);
+        CHECK(pool.stats().size == 2u);
+        CHECK(pool.stats().high_water_mark == 2u);
+
+        int visited = 0;
+        pool.for_each_in_use([&visited](PooledObject*) { ++visited; });
+        CHECK(visited == 2);
+
+        pool.release(second);
+        CHECK(pool.stats().in_use == 1u);
+    }
+
+    // Objects still in use are destroyed with the pool
+    CHECK(alive == 0);
+}
+#endif
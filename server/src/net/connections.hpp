@@ -1,14 +1,31 @@
 #pragma once
 
 // project
+#include "net/call_arena.hpp"
+#include "net/metrics.hpp"
+#include "net/rpc_options.hpp"
+#include "net/serialized_message.hpp"
 #include "net/tagger.hpp"
+#include "net/tracer.hpp"
 #include "testing/testing.hpp"
 
 // thirdparty
+#include <grpcpp/alarm.h>
 #include <grpcpp/server_context.h>
+#include <grpcpp/support/async_stream.h>
 
 // standard
-#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
 #include <testing/echo.grpc.pb.h>
@@ -20,27 +37,129 @@ namespace net {
  * Forward declaration
  */
 namespace detail {
+template <typename Response>
+class DeferredResponse;
+
 template <typename Response>
 struct ServerStreamRpcConnection;
+
+template <typename Request>
+struct StreamReadState;
+
+template <typename Request, typename Response>
+struct ClientStreamRpcConnection;
 } // namespace detail
 
+/**
+ * @brief Finishes a unary call after its connect callback has returned, so the response can be computed
+ *        on another thread without holding up the completion queue.
+ *
+ *     Copies share the same call. The call is finished by the first `finish` (from any thread) and later
+ *     ones are ignored. If every copy is destroyed without finishing the call it fails with `INTERNAL`.
+ *
+ *     The server doesn't wait for a responder that never finishes: the call is ended for it when the
+ *     client cancels, its deadline passes or the server shuts down, and `cancelled` becomes true.
+ */
+template <typename Response>
+class UnaryResponder {
+public:
+    explicit UnaryResponder(std::shared_ptr<detail::DeferredResponse<Response>> deferred);
+
+    /**
+     * @brief The response sent if the call finishes with an OK status. It belongs to the responder so it
+     *        can still be written after the call has ended, but changes made after `finish` are not sent.
+     */
+    Response* response() const;
+
+    void finish(const grpc::Status& status) const;
+
+    /**
+     * @brief Whether the call was ended without waiting for `finish`, so a slow response can be abandoned.
+     */
+    bool cancelled() const;
+
+private:
+    std::shared_ptr<detail::DeferredResponse<Response>> deferred_;
+};
+
 template <typename Response>
 class ServerToClientStream {
 public:
     explicit ServerToClientStream(detail::ServerStreamRpcConnection<Response>* connection);
 
     /**
-     * @brief
+     * @brief Queues a response to be sent to the client.
+     *
+     *     If the stream's send queue is full the RPC's `OverflowPolicy` decides what happens. Writes must
+     *     not race with the stream's disconnect callback (the stream is recycled once that returns). A
+     *     write blocked by `OverflowPolicy::block_producer` is the exception: it returns false when the
+     *     call ends and the stream is only recycled once it has.
+     *
+     * @return false if the response was dropped or the stream has already finished
+     */
+    bool write(const Response& response);
+
+    /**
+     * @brief Queues a response that has already been serialized. The stream shares the serialized
+     *        bytes instead of copying them, so one `SerializedMessage` can be written to many streams.
+     *
+     * @return false if the response was dropped or the stream has already finished
+     */
+    bool write(const SerializedMessage<Response>& response);
+
+    /**
+     * @brief Builds a response by calling `fill(Response&)` and queues it.
+     *
+     *     The message passed to `fill` is new and lives on an arena whose first block is on the stack, so
+     *     responses that fit in it don't touch the heap until they're serialized. `fill` may emplace
+     *     other responses itself. The response is still serialized into its own buffer like `write`
+     *     does, which is the one copy of its bytes before gRPC sends them.
+     *
+     * @return false if the response was dropped or the stream has already finished
+     */
+    template <typename Fill>
+    bool emplace(Fill&& fill);
+
+    /**
+     * @brief Queues every response in `responses` in order while only taking the stream's lock once.
+     *        The responses are serialized before the lock is taken.
+     *
+     * @tparam Range - A range of `Response` or `SerializedMessage<Response>`
+     * @return the number of responses that were queued
+     */
+    template <typename Range>
+    std::size_t write_all(const Range& responses);
+
+    /**
+     * @brief Sets a callback that is run on the stream's completion queue thread whenever every queued
+     *        response has been sent and `finish` hasn't been called yet, including right after the connect
+     *        callback if it didn't write anything. Lets a handler write the next page of responses as the
+     *        client reads them instead of queueing everything up front.
+     *
+     *     Only call this from the connect callback. The callback can write and finish the stream.
      */
-    void write(const Response& response);
+    void on_drained(std::function<void()> callback);
 
     /**
      * @brief Only call once. After calling this function the stream should not be used anymore.
+     *
+     *     The status is sent once every queued response has been. Streams still open when the server
+     *     drains (see `AsyncServer::drain`) are finished by the server, after which this does nothing.
      */
     void finish(const grpc::Status& status);
 
     std::unique_ptr<grpc::Status> status();
 
+    /**
+     * @brief The number of responses written to the stream that the client hasn't received yet
+     */
+    std::size_t queued_messages();
+
+    /**
+     * @brief The serialized size of the responses counted by `queued_messages`
+     */
+    std::size_t queued_bytes();
+
 private:
     detail::ServerStreamRpcConnection<Response>* connection_;
 };
@@ -49,128 +168,1202 @@ private:
 template class ServerToClientStream<testing::proto::EchoResponse>;
 #endif
 
+/**
+ * @brief The requests a client sends on a client or bidirectional stream.
+ *
+ *     Only one read is outstanding at a time and the next one isn't started until the read callback has
+ *     returned, so a client can't send requests faster than they are handled. Pausing holds off the next
+ *     read entirely (e.g. while requests are handled on another thread) and lets gRPC's flow control push
+ *     back on the client.
+ */
+template <typename Request>
+class StreamReader {
+public:
+    explicit StreamReader(detail::StreamReadState<Request>* state);
+
+    /**
+     * @brief Sets the callback run on the stream's completion queue thread for every request the client
+     *        sends. Only call this from the connect callback.
+     */
+    void on_read(std::function<void(const Request&)> callback);
+
+    /**
+     * @brief Stops reading requests once the current read completes. Safe to call from any thread.
+     */
+    void pause_reading();
+
+    /**
+     * @brief Starts reading requests again. Safe to call from any thread until the stream is disconnected.
+     */
+    void resume_reading();
+
+private:
+    detail::StreamReadState<Request>* state_;
+};
+
+/**
+ * @brief A client streaming call. The client sends any number of requests and gets a single response.
+ */
+template <typename Request, typename Response>
+class ClientToServerStream : public StreamReader<Request> {
+public:
+    explicit ClientToServerStream(detail::ClientStreamRpcConnection<Request, Response>* connection);
+
+    /**
+     * @brief Sets the callback run once the client has sent its last request. It fills in the response
+     *        and returns the status the call finishes with. Only call this from the connect callback.
+     */
+    void on_read_done(std::function<grpc::Status(Response*)> callback);
+
+    /**
+     * @brief Ends the call without reading the rest of the requests (e.g. when one of them is invalid).
+     *        An empty response is sent if the status is OK.
+     */
+    void finish(const grpc::Status& status);
+
+private:
+    detail::ClientStreamRpcConnection<Request, Response>* connection_;
+};
+
+/**
+ * @brief A bidirectional streaming call. Responses are written with the same rules as a
+ *        `ServerToClientStream` while requests are being read.
+ */
+template <typename Request, typename Response>
+class BidiStream : public ServerToClientStream<Response>, public StreamReader<Request> {
+public:
+    BidiStream(detail::ServerStreamRpcConnection<Response>* connection,
+               detail::StreamReadState<Request>* read_state,
+               std::function<void()>* read_done_callback);
+
+    /**
+     * @brief Sets the callback run once the client has sent its last request. The stream stays open
+     *        until `finish` is called. Only call this from the connect callback.
+     */
+    void on_read_done(std::function<void()> callback);
+
+private:
+    std::function<void()>* read_done_callback_;
+};
+
 namespace detail {
 
 enum class ProcessState { processing, finished };
 
+struct Connection;
+
+/**
+ * @brief A unary call that was handed to a `UnaryResponder`, as seen by the RPC call it belongs to.
+ */
+struct DeferredCall {
+    virtual ~DeferredCall() = 0;
+
+    /**
+     * @brief Finishes the call with `status` if the responder hasn't yet and marks it cancelled.
+     */
+    virtual void cancel(const grpc::Status& status) = 0;
+};
+
+inline DeferredCall::~DeferredCall() = default;
+
+/**
+ * @brief The RPC call that created a connection. It is told when the client disconnects and gets the
+ *        connection back once no more of its tags are on the queue.
+ */
+struct ConnectionOwner {
+    virtual ~ConnectionOwner() = 0;
+    virtual void disconnect(Connection* connection) = 0;
+    virtual void recycle(Connection* connection) = 0;
+
+    /**
+     * @brief Called when a connection hands its response to a `UnaryResponder`.
+     * @return false if the server is shutting down, in which case the call is finished right away
+     */
+    virtual bool defer_response(const std::shared_ptr<DeferredCall>& call) = 0;
+
+    /**
+     * @brief Called from any thread once a deferred response has been handed to gRPC.
+     */
+    virtual void deferred_response_finished(DeferredCall* call) = 0;
+};
+
+inline ConnectionOwner::~ConnectionOwner() = default;
+
+/**
+ * @brief Whether the calling thread polls one of the server's completion queues. Set by the thread itself
+ *        before it processes any events.
+ */
+inline bool& on_poller_thread() {
+    thread_local bool poller = false;
+    return poller;
+}
+
 struct Connection {
+    ConnectionOwner* owner = nullptr;
+
+    TagCount tag_count{0u};
+    Tag processing_tag{TagLabel::processing, this, &tag_count};
+    Tag reading_tag{TagLabel::reading, this, &tag_count};
+    Tag finished_tag{TagLabel::rpc_finished, this, &tag_count};
+    Tag connected_tag{TagLabel::connected, this, &tag_count};
+
+    // Set while the connect callback runs on a handler thread. The alarm posts `connected_tag` back to
+    // the completion queue once it returns. Only touched by the completion queue thread.
+    bool connecting = false;
+    bool finished_while_connecting = false;
+    std::unique_ptr<grpc::Alarm> connected_alarm;
+
+    // When the client's call was accepted. Left at the epoch for connections that never got a call.
+    std::chrono::steady_clock::time_point started;
+
+    // The client's deadline for the call, the max time point if it didn't set one
+    std::chrono::system_clock::time_point deadline = std::chrono::system_clock::time_point::max();
+
+    // The code of the status the call was finished with, set before the status is handed to gRPC
+    grpc::StatusCode finish_code = grpc::StatusCode::OK;
+
+    // Set when the call was refused (by admission control, because its deadline passed before it started
+    // or because its request couldn't be parsed), in which case no callback is ever run
+    bool rejected = false;
+
+    // Whether the call counts towards its RPC's `RpcOptions::max_in_flight`
+    bool holds_in_flight = false;
+
+    // The bytes queued on every server stream of the server, shared by all of its connections
+    std::atomic<std::size_t>* buffered_stream_bytes = nullptr;
+
+    // The counters of the RPC call that created the connection. Streams keep its send queue gauges.
+    RpcCounters* counters = nullptr;
+
     virtual ~Connection() = 0;
+
+    bool expired() const {
+        return deadline != std::chrono::system_clock::time_point::max()
+            && deadline <= std::chrono::system_clock::now();
+    }
+
+    /**
+     * @brief Called once after the connect callback has run so the connection can put its first
+     *        tag on the queue (if the callback didn't already cause one to be added).
+     */
+    virtual void start() = 0;
     virtual void add_next_tag_to_queue() = 0;
     virtual void cancel() = 0;
+
+    /**
+     * @brief Called when the server starts draining. Connections that would otherwise stay open until
+     *        the client or handler ends them finish with `status` once they have sent what they have.
+     */
+    virtual void drain(const grpc::Status& /*status*/) {}
+
+    /**
+     * @brief Finishes a call that was just accepted with `status` instead of running its connect
+     *        callback. The connection isn't started afterwards.
+     */
+    virtual void reject(const grpc::Status& status) = 0;
+
+    /**
+     * @brief Called when an operation that put the processing tag on the queue failed, meaning the call
+     *        is over even if `rpc_finished` hasn't come back yet.
+     */
+    virtual void processing_failed() {}
+
+    /**
+     * @brief Called when a read from a client stream completes. `ok` is false once the client has
+     *        sent its last request (or the call has ended).
+     */
+    virtual void read_completed(bool /*ok*/) {}
+
+    /**
+     * @brief Called when the call is done (finished or cancelled) before the disconnect callback is run.
+     */
+    virtual void close() = 0;
+
+    /**
+     * @brief Called right before the connection is recycled. Returns once no other thread is using it.
+     */
+    virtual void release() {}
 };
 
 inline Connection::~Connection() = default;
 
 /**
  * @brief
- * @tparam Request
  * @tparam Response
  */
 template <typename Response>
 struct UnaryRpcConnection : Connection {
-    Tagger* tagger;
     grpc::ServerContext context;
-    Response response;
+    CallMessage<Response> response;
     grpc::Status status;
     grpc::ServerAsyncResponseWriter<Response> responder;
     ProcessState state;
+    void* deferred_tag = nullptr; // The processing tag, made when the response is handed to a `UnaryResponder`
+    std::weak_ptr<DeferredResponse<Response>> deferred; // Ended on `close` if the responder hasn't finished it
 
-    explicit UnaryRpcConnection(Tagger* tgr) : tagger(tgr), responder(&context), state(ProcessState::processing) {}
+    UnaryRpcConnection(google::protobuf::Arena* arena, const RpcOptions& /*options*/)
+        : response(arena), responder(&context), state(ProcessState::processing) {}
     ~UnaryRpcConnection() override = default;
 
+    Response* callback_response() { return response.get(); }
+
+    /**
+     * @brief Runs a `grpc::Status(const Request&, Response*)` callback, or hands a `UnaryResponder` to a
+     *        `void(const Request&, UnaryResponder<Response>)` callback.
+     */
+    template <typename Request, typename ConnectCallback>
+    void connect(const Request& request, ConnectCallback& connect_callback) {
+        connect(request, connect_callback, IsImmediateCallback<ConnectCallback, Request>{});
+    }
+
+    /**
+     * @brief Finishes a deferred call. Only called once, by `DeferredResponse`. The response is serialized
+     *        right away so it doesn't have to outlive the call.
+     */
+    void finish_deferred(DeferredCall* call, const grpc::Status& final_status, const Response& final_response) {
+        finish_code = final_status.error_code();
+        if (final_status.ok()) {
+            responder.Finish(final_response, final_status, deferred_tag);
+        } else {
+            responder.FinishWithError(final_status, deferred_tag);
+        }
+        owner->deferred_response_finished(call);
+    }
+
+    grpc::ServerAsyncResponseWriter<Response>* writer() { return &responder; }
+
+    void start() override { add_next_tag_to_queue(); }
+
     void add_next_tag_to_queue() override {
         if (state == ProcessState::processing) {
-            responder.Finish(response, status, tagger->make_tag(TagLabel::processing, this));
+            finish_code = status.error_code();
+            responder.Finish(*response, status, Tagger::make_tag(&processing_tag));
             state = ProcessState::finished;
         }
     }
 
     void cancel() override { context.TryCancel(); }
+
+    void reject(const grpc::Status& final_status) override {
+        finish_code = final_status.error_code();
+        responder.FinishWithError(final_status, Tagger::make_tag(&processing_tag));
+        state = ProcessState::finished;
+    }
+
+    void close() override {
+        if (auto deferred_response = deferred.lock()) {
+            deferred_response->cancel(grpc::Status(grpc::StatusCode::CANCELLED, "The call was cancelled"));
+        }
+    }
+
+private:
+    template <typename...>
+    using Void = void;
+
+    template <typename ConnectCallback, typename Request, typename = void>
+    struct IsImmediateCallback : std::false_type {};
+
+    template <typename ConnectCallback, typename Request>
+    struct IsImmediateCallback<
+        ConnectCallback,
+        Request,
+        Void<decltype(std::declval<ConnectCallback&>()(std::declval<const Request&>(), std::declval<Response*>()))>>
+        : std::true_type {};
+
+    template <typename Request, typename ConnectCallback>
+    void connect(const Request& request, ConnectCallback& connect_callback, std::true_type /*immediate*/) {
+        status = connect_callback(request, callback_response());
+    }
+
+    template <typename Request, typename ConnectCallback>
+    void connect(const Request& request, ConnectCallback& connect_callback, std::false_type /*immediate*/) {
+        // Nothing is sent when the connection starts
+        state = ProcessState::finished;
+
+        // Counted from now on so the connection can't be recycled while a responder might still use it,
+        // even if the client disconnects first
+        deferred_tag = Tagger::make_tag(&processing_tag);
+
+        auto deferred_response = std::make_shared<DeferredResponse<Response>>(this);
+        deferred = deferred_response;
+
+        if (!owner->defer_response(deferred_response)) {
+            deferred_response->cancel(grpc::Status(grpc::StatusCode::UNAVAILABLE, "The server is shutting down"));
+            return;
+        }
+        connect_callback(request, UnaryResponder<Response>(std::move(deferred_response)));
+    }
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
 template struct UnaryRpcConnection<testing::proto::EchoResponse>;
 #endif
 
+/**
+ * @brief The call shared by copies of a `UnaryResponder`.
+ *
+ *     The connection is forgotten as soon as the call is finished since it may be recycled once gRPC is
+ *     done with it, while copies of the responder can live on. The response is kept here rather than in
+ *     the connection's arena for the same reason.
+ *
+ * @tparam Response
+ */
+template <typename Response>
+class DeferredResponse : public DeferredCall {
+public:
+    explicit DeferredResponse(UnaryRpcConnection<Response>* connection) : connection_(connection) {}
+
+    ~DeferredResponse() override {
+        finish(grpc::Status(grpc::StatusCode::INTERNAL, "The call was dropped without a response"));
+    }
+
+    DeferredResponse(const DeferredResponse&) = delete;
+    DeferredResponse& operator=(const DeferredResponse&) = delete;
+
+    Response* response() { return &response_; }
+
+    bool cancelled() const { return cancelled_.load(); }
+
+    void finish(const grpc::Status& status) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (connection_) {
+            connection_->finish_deferred(this, status, response_);
+            connection_ = nullptr;
+        }
+    }
+
+    void cancel(const grpc::Status& status) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (connection_) {
+            cancelled_ = true;
+            connection_->finish_deferred(this, status, response_);
+            connection_ = nullptr;
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    UnaryRpcConnection<Response>* connection_;
+    Response response_;
+    std::atomic_bool cancelled_{false};
+};
+
 /**
  * @brief
+ *
+ *     `mutex` guards everything below it since `ServerToClientStream::write` can be called from
+ *     any thread while this connection's completion queue thread is processing its tags.
+ *
+ *     The front of `queue` is the response currently being written whenever the queue isn't empty.
+ *     Responses are queued already serialized so a broadcast `SerializedMessage` is shared by every
+ *     stream it is written to.
+ *
+ *     The gRPC stream itself belongs to the derived connection (`ServerWriterRpcConnection` or
+ *     `BidiStreamRpcConnection`) since server and bidirectional streams use different gRPC types.
+ *
  * @tparam Response
  */
 template <typename Response>
 struct ServerStreamRpcConnection : Connection {
-    Tagger* tagger;
+    struct QueuedResponse {
+        grpc::ByteBuffer buffer;
+        std::size_t bytes;
+    };
+
+    std::mutex mutex;
+    std::condition_variable queue_space; // Notified when queued responses are sent, the call ends or a writer leaves
     grpc::ServerContext context;
     std::unique_ptr<grpc::Status> status;
-    grpc::ServerAsyncWriter<Response> responder;
-    std::queue<Response> queue;
+    SendQueueOptions send_queue_options;
+    WriteBatchOptions write_batch_options;
+    std::deque<QueuedResponse> queue;
+    std::size_t queued_bytes;
+    std::size_t batch_messages; // Written with a buffer hint since the last flush
+    std::size_t batch_bytes;
+    std::size_t blocked_writers; // Waiting on `queue_space` for room in the queue
     ProcessState state;
+    bool closed; // No more responses will be sent
+    std::function<void()> drained_callback;
     ServerToClientStream<Response> response;
 
-    explicit ServerStreamRpcConnection(Tagger* tgr)
-        : tagger(tgr), responder(&context), state(ProcessState::processing), response(this) {}
+    // Responses are serialized when they are written so they don't use the call's arena
+    ServerStreamRpcConnection(google::protobuf::Arena* /*arena*/, const RpcOptions& options)
+        : send_queue_options(options.send_queue),
+          write_batch_options(options.write_batch),
+          queued_bytes(0u),
+          batch_messages(0u),
+          batch_bytes(0u),
+          blocked_writers(0u),
+          state(ProcessState::processing),
+          closed(false),
+          response(this) {}
+
+    // Responses still queued when the call ended are only freed with the connection
+    ~ServerStreamRpcConnection() override { remove_queued(queue.size(), queued_bytes); }
+
+    ServerToClientStream<Response>* callback_response() { return &response; }
 
-    ~ServerStreamRpcConnection() override = default;
+    /*
+     * Operations on the gRPC stream. Each puts the processing tag on the queue.
+     */
+    virtual void stream_write(const grpc::ByteBuffer& buffer, grpc::WriteOptions options) = 0;
+    virtual void stream_write_and_finish(const grpc::ByteBuffer& buffer, const grpc::Status& final_status) = 0;
+    virtual void stream_finish(const grpc::Status& final_status) = 0;
+
+    // Writes and 'Finish' are put on the queue by the stream itself unless the handler pulls them
+    void start() override {
+        std::unique_lock<std::mutex> lock(mutex);
+        run_drained_callback(&lock);
+    }
 
     void add_next_tag_to_queue() override {
+        std::unique_lock<std::mutex> lock(mutex);
+
         if (state == ProcessState::finished) {
             return;
         }
 
         // The current state has just been processed so we can pop it from the queue
         if (!queue.empty()) {
-            queue.pop();
+            remove_queued(1u, queue.front().bytes);
+            queue.pop_front();
+
+            if (blocked_writers != 0u) {
+                queue_space.notify_all();
+            }
         }
 
         // If more responses need to be processed then write the next one to the stream
         if (!queue.empty()) {
-            responder.Write(queue.front(), tagger->make_tag(detail::TagLabel::processing, this));
+            write_front();
         }
 
         // If the user has finished the with stream and set the status then call 'Finish'
         // on the stream. We will only reach this point if the queue is already empty.
         else if (status != nullptr) {
-            responder.Finish(*status, tagger->make_tag(detail::TagLabel::processing, this));
+            stream_finish(*status);
             state = ProcessState::finished;
         }
+
+        // Otherwise ask the handler for more
+        else {
+            run_drained_callback(&lock);
+        }
+    }
+
+    /**
+     * @brief Runs the drained callback if the stream is idle. `lock` must hold `mutex` and is released
+     *        before the callback runs since writes and 'Finish' take it again (and put their own tags on
+     *        the queue).
+     */
+    void run_drained_callback(std::unique_lock<std::mutex>* lock) {
+        if (!drained_callback || !accepting_writes() || !queue.empty() || status != nullptr) {
+            return;
+        }
+
+        // Nobody would read the responses it writes
+        if (expired()) {
+            drop_unsent(/*keep_front=*/false);
+            context.TryCancel();
+            return;
+        }
+        lock->unlock();
+
+        // Only set from the connect callback, which has already run, so it's safe to use unlocked
+        drained_callback();
     }
 
     void cancel() override { context.TryCancel(); }
+
+    void reject(const grpc::Status& final_status) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        finish_code = final_status.error_code();
+        stream_finish(final_status);
+        state = ProcessState::finished;
+    }
+
+    /**
+     * @brief Writes the response at the front of the queue, buffering it with the ones behind it when
+     *        write batching is enabled.
+     */
+    void write_front() {
+        const QueuedResponse& next = queue.front();
+        bool batching = write_batch_options.max_messages != 0u;
+
+        // The status is already known so it can go out with the last response
+        if (batching && status != nullptr && queue.size() == 1u) {
+            stream_write_and_finish(next.buffer, *status);
+            state = ProcessState::finished;
+            return;
+        }
+
+        grpc::WriteOptions options;
+
+        if (batching && queue.size() > 1u) {
+            ++batch_messages;
+            batch_bytes += next.bytes;
+
+            bool batch_full = batch_messages >= write_batch_options.max_messages
+                || (write_batch_options.max_bytes != 0u && batch_bytes >= write_batch_options.max_bytes);
+
+            if (!batch_full) {
+                options.set_buffer_hint();
+            }
+        }
+
+        if (!options.get_buffer_hint()) {
+            batch_messages = 0u;
+            batch_bytes = 0u;
+        }
+
+        stream_write(next.buffer, options);
+    }
+
+    void drain(const grpc::Status& final_status) override { response.finish(final_status); }
+
+    // The front of the queue may still be in a write that gRPC has yet to hand back
+    void close() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        drop_unsent(/*keep_front=*/true);
+    }
+
+    // A failed write means the client is gone, without waiting for 'rpc_finished'
+    void processing_failed() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        drop_unsent(/*keep_front=*/false);
+    }
+
+    // Writers woken by the end of the call still have to take the lock again before they can return
+    void release() override {
+        std::unique_lock<std::mutex> lock(mutex);
+        closed = true;
+        queue_space.notify_all();
+        queue_space.wait(lock, [this] { return blocked_writers == 0u; });
+    }
+
+    /**
+     * @brief Drops the responses the client will never receive and stops accepting new ones.
+     *        `mutex` must be held.
+     *
+     * @param keep_front - Keeps the response at the front of the queue since it is being written
+     */
+    void drop_unsent(bool keep_front) {
+        std::size_t kept = keep_front ? std::min<std::size_t>(queue.size(), 1u) : 0u;
+
+        for (auto i = kept; i < queue.size(); ++i) {
+            remove_queued(1u, queue[i].bytes);
+        }
+        queue.erase(queue.begin() + static_cast<std::ptrdiff_t>(kept), queue.end());
+
+        closed = true;
+        queue_space.notify_all();
+    }
+
+    /**
+     * @brief Queues a serialized response, writing it straight away if nothing else is being sent. The
+     *        queued buffer shares `buffer`'s slices. `lock` must hold `mutex`.
+     *
+     * @return false if the response was dropped or the stream has already finished
+     */
+    bool enqueue(const grpc::ByteBuffer& buffer, std::size_t bytes, std::unique_lock<std::mutex>* lock) {
+        if (!make_room_to_queue(bytes, lock)) {
+            return false;
+        }
+        queue.emplace_back();
+        queue.back().buffer = buffer;
+        queue.back().bytes = bytes;
+
+        write_queued(bytes);
+        return true;
+    }
+
+    /**
+     * @brief Same as above but takes `buffer` over (leaving it empty) instead of referencing it again,
+     *        which saves an allocation for every response that isn't shared with other streams.
+     */
+    bool enqueue(grpc::ByteBuffer&& buffer, std::size_t bytes, std::unique_lock<std::mutex>* lock) {
+        if (!make_room_to_queue(bytes, lock)) {
+            return false;
+        }
+        queue.emplace_back();
+        queue.back().buffer.Swap(&buffer);
+        queue.back().bytes = bytes;
+
+        write_queued(bytes);
+        return true;
+    }
+
+    /**
+     * @brief Checks that a response of size `bytes` can be queued, applying the overflow policy.
+     *        `lock` must hold `mutex`.
+     */
+    bool make_room_to_queue(std::size_t bytes, std::unique_lock<std::mutex>* lock) {
+        // Nothing may follow the status, which the server sets itself when it drains
+        if (!accepting_writes() || status != nullptr) {
+            return false;
+        }
+
+        // The client has given up on the call so nothing written from now on would be read
+        if (expired()) {
+            drop_unsent(/*keep_front=*/true);
+            context.TryCancel();
+            return false;
+        }
+        return make_room_for(bytes, lock);
+    }
+
+    /**
+     * @brief Counts the response just pushed to the back of the queue and writes it to the stream if
+     *        nothing else is being sent.
+     */
+    void write_queued(std::size_t bytes) {
+        // If no other responses were queued then write directly to the stream
+        if (queue.size() == 1u) {
+            write_front();
+        }
+        queued_bytes += bytes;
+
+        if (buffered_stream_bytes) {
+            buffered_stream_bytes->fetch_add(bytes, std::memory_order_relaxed);
+        }
+        if (counters) {
+            counters->response_queued(bytes, queue.size());
+        }
+    }
+
+    /**
+     * @brief Takes responses that are no longer queued out of the stream's, the RPC's and the server's
+     *        counts.
+     */
+    void remove_queued(std::size_t messages, std::size_t bytes) {
+        queued_bytes -= bytes;
+
+        if (buffered_stream_bytes) {
+            buffered_stream_bytes->fetch_sub(bytes, std::memory_order_relaxed);
+        }
+        if (counters) {
+            counters->responses_unqueued(messages, bytes);
+        }
+    }
+
+    bool accepting_writes() const { return state == ProcessState::processing && !closed; }
+
+    bool has_room_for(std::size_t bytes) const {
+        const SendQueueOptions& limits = send_queue_options;
+
+        bool messages_fit = limits.max_queued_messages == 0u || queue.size() < limits.max_queued_messages;
+
+        // A single response bigger than the byte limit is still sent once everything before it has been
+        bool bytes_fit = limits.max_queued_bytes == 0u || queue.empty() || queued_bytes + bytes <= limits.max_queued_bytes;
+
+        return messages_fit && bytes_fit;
+    }
+
+    /**
+     * @brief Applies the overflow policy until a response of size `bytes` fits in the queue.
+     * @return false if the response should be dropped
+     */
+    bool make_room_for(std::size_t bytes, std::unique_lock<std::mutex>* lock) {
+        while (!has_room_for(bytes)) {
+            switch (send_queue_options.overflow_policy) {
+
+            case OverflowPolicy::block_producer:
+                // Waiting on a completion queue thread would stop its queue (maybe this one) from draining
+                if (on_poller_thread()) {
+                    return false;
+                }
+                ++blocked_writers;
+                queue_space.wait(*lock);
+                --blocked_writers;
+
+                if (!accepting_writes()) {
+                    queue_space.notify_all();
+                    return false;
+                }
+                break;
+
+            case OverflowPolicy::drop_oldest:
+                // The front of the queue is already being written so it can't be dropped
+                if (queue.size() < 2u) {
+                    return false;
+                }
+                remove_queued(1u, queue[1].bytes);
+                queue.erase(queue.begin() + 1);
+                break;
+
+            case OverflowPolicy::drop_newest:
+                return false;
+
+            case OverflowPolicy::disconnect:
+                // Everything but the response being written is dropped and the client is cut off
+                drop_unsent(/*keep_front=*/true);
+                context.TryCancel();
+                return false;
+            }
+        }
+        return true;
+    }
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
 template struct ServerStreamRpcConnection<testing::proto::EchoResponse>;
 #endif
 
+/**
+ * @brief The message type a stream's gRPC calls take: bytes for methods marked raw in the async service
+ *        (see `raw_stream`), the proto message otherwise.
+ */
+template <typename Message, bool Raw>
+using StreamMessage = std::conditional_t<Raw, grpc::ByteBuffer, Message>;
+
+/**
+ * @brief Turns a queued response into what the stream's gRPC writer takes. Raw methods write the queued
+ *        bytes as they are.
+ */
+template <typename Response, bool Raw>
+struct StreamWriteMessage {
+    const grpc::ByteBuffer& operator()(const grpc::ByteBuffer& buffer) { return buffer; }
+};
+
+/**
+ * @brief Typed methods take a `Response`, so each queued response is parsed back into `message` and gRPC
+ *        serializes it again: a parse and a serialization more per message than a raw method. Only one
+ *        write is in progress at a time and gRPC serializes it before `Write` returns, so one message does.
+ */
+template <typename Response>
+struct StreamWriteMessage<Response, false> {
+    Response message;
+
+    const Response& operator()(const grpc::ByteBuffer& buffer) {
+        // Parsing consumes the buffer, and copying one only adds references to its slices
+        grpc::ByteBuffer parsed(buffer);
+        grpc::SerializationTraits<Response>::Deserialize(&parsed, &message);
+        return message;
+    }
+};
+
+/**
+ * @brief
+ * @tparam Response
+ * @tparam Raw - Whether the method is marked raw in the async service
+ */
+template <typename Response, bool Raw = true>
+struct ServerWriterRpcConnection : ServerStreamRpcConnection<Response> {
+    grpc::ServerAsyncWriter<StreamMessage<Response, Raw>> responder;
+    StreamWriteMessage<Response, Raw> write_message;
+
+    ServerWriterRpcConnection(google::protobuf::Arena* arena, const RpcOptions& options)
+        : ServerStreamRpcConnection<Response>(arena, options), responder(&this->context) {}
+    ~ServerWriterRpcConnection() override = default;
+
+    grpc::ServerAsyncWriter<StreamMessage<Response, Raw>>* writer() { return &responder; }
+
+    template <typename Request, typename ConnectCallback>
+    void connect(const Request& request, ConnectCallback& connect_callback) {
+        this->status = connect_callback(request, this->callback_response());
+    }
+
+    void stream_write(const grpc::ByteBuffer& buffer, grpc::WriteOptions options) override {
+        HELLO_TRACE_SPAN("Write", "grpc");
+        responder.Write(write_message(buffer), options, Tagger::make_tag(&this->processing_tag));
+    }
+
+    void stream_write_and_finish(const grpc::ByteBuffer& buffer, const grpc::Status& final_status) override {
+        responder.WriteAndFinish(
+            write_message(buffer), grpc::WriteOptions{}, final_status, Tagger::make_tag(&this->processing_tag));
+    }
+
+    void stream_finish(const grpc::Status& final_status) override {
+        responder.Finish(final_status, Tagger::make_tag(&this->processing_tag));
+    }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+template struct ServerWriterRpcConnection<testing::proto::EchoResponse>;
+template struct ServerWriterRpcConnection<testing::proto::EchoResponse, false>;
+#endif
+
+/**
+ * @brief The reading half of client and bidirectional streaming connections (see `StreamReader`).
+ *
+ *     `mutex` guards the flags below it since reading can be paused and resumed from any thread. The
+ *     request is only touched by gRPC and the read callback, never by both at once.
+ *
+ * @tparam Request
+ */
+template <typename Request>
+struct StreamReadState {
+    CallMessage<Request> request; // Every request is read into the same message
+    std::function<void(Request*)> start_read; // Puts a read into `request` on the queue
+    std::function<void(const Request&)> read_callback;
+
+    std::mutex mutex;
+    bool paused = false;
+    bool pending = false; // A read is on the queue or its request is being handled
+    bool done = false; // The client has sent its last request or the call has ended
+
+    StreamReadState(google::protobuf::Arena* arena, std::function<void(Request*)> start)
+        : request(arena), start_read(std::move(start)) {}
+
+    void read_next() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (paused || pending || done) {
+            return;
+        }
+        pending = true;
+        start_read(request.get());
+    }
+
+    /**
+     * @brief Passes a request that was just read to the read callback and starts the next read, or calls
+     *        `on_done()` if the client has stopped sending.
+     */
+    template <typename Done>
+    void read_completed(bool ok, Done&& on_done) {
+        if (!ok) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending = false;
+                done = true;
+            }
+            on_done();
+            return;
+        }
+
+        if (read_callback) {
+            read_callback(*request);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = false;
+        }
+        read_next();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+};
+
+/**
+ * @brief
+ *
+ *     `mutex` guards `state` since the call can be finished early from any thread.
+ *
+ * @tparam Request
+ * @tparam Response
+ */
+template <typename Request, typename Response>
+struct ClientStreamRpcConnection : Connection {
+    grpc::ServerContext context;
+    CallMessage<Response> response;
+    grpc::ServerAsyncReader<Response, Request> responder;
+    StreamReadState<Request> read_state;
+    std::function<grpc::Status(Response*)> read_done_callback;
+
+    std::mutex mutex;
+    ProcessState state;
+
+    ClientToServerStream<Request, Response> stream;
+
+    ClientStreamRpcConnection(google::protobuf::Arena* arena, const RpcOptions& /*options*/)
+        : response(arena),
+          responder(&context),
+          read_state(arena,
+                     [this](Request* request) { responder.Read(request, Tagger::make_tag(&reading_tag)); }),
+          state(ProcessState::processing),
+          stream(this) {}
+
+    ~ClientStreamRpcConnection() override = default;
+
+    ClientToServerStream<Request, Response>* callback_response() { return &stream; }
+
+    grpc::ServerAsyncReader<Response, Request>* writer() { return &responder; }
+
+    void start() override { read_state.read_next(); }
+
+    // Only 'Finish' uses the processing tag so there is nothing left to do once it completes
+    void add_next_tag_to_queue() override {}
+
+    void cancel() override { context.TryCancel(); }
+
+    void reject(const grpc::Status& final_status) override { finish(final_status); }
+
+    void close() override { read_state.close(); }
+
+    void read_completed(bool ok) override {
+        read_state.read_completed(ok, [this] {
+            grpc::Status status = read_done_callback ? read_done_callback(response.get()) : grpc::Status::OK;
+            finish(status);
+        });
+    }
+
+    void finish(const grpc::Status& status) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (state == ProcessState::finished) {
+            return;
+        }
+        read_state.close();
+        finish_code = status.error_code();
+
+        if (status.ok()) {
+            responder.Finish(*response, status, Tagger::make_tag(&processing_tag));
+        } else {
+            responder.FinishWithError(status, Tagger::make_tag(&processing_tag));
+        }
+        state = ProcessState::finished;
+    }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+template struct ClientStreamRpcConnection<testing::proto::EchoRequest, testing::proto::EchoResponse>;
+#endif
+
+/**
+ * @brief
+ * @tparam Request
+ * @tparam Response
+ * @tparam Raw - Whether the method is marked raw in the async service
+ */
+template <typename Request, typename Response, bool Raw = true>
+struct BidiStreamRpcConnection : ServerStreamRpcConnection<Response> {
+    grpc::ServerAsyncReaderWriter<StreamMessage<Response, Raw>, StreamMessage<Request, Raw>> responder;
+    grpc::ByteBuffer read_buffer; // Raw methods read requests as bytes and parse them into `read_state`
+    StreamReadState<Request> read_state;
+    std::function<void()> read_done_callback;
+    StreamWriteMessage<Response, Raw> write_message;
+
+    BidiStream<Request, Response> stream;
+
+    BidiStreamRpcConnection(google::protobuf::Arena* arena, const RpcOptions& options)
+        : ServerStreamRpcConnection<Response>(arena, options),
+          responder(&this->context),
+          read_state(arena,
+                     [this](Request* request) {
+                         responder.Read(read_target(request, std::integral_constant<bool, Raw>{}),
+                                        Tagger::make_tag(&this->reading_tag));
+                     }),
+          stream(this, &read_state, &read_done_callback) {}
+
+    ~BidiStreamRpcConnection() override = default;
+
+    BidiStream<Request, Response>* callback_response() { return &stream; }
+
+    grpc::ServerAsyncReaderWriter<StreamMessage<Response, Raw>, StreamMessage<Request, Raw>>* writer() {
+        return &responder;
+    }
+
+    grpc::ByteBuffer* read_target(Request* /*request*/, std::true_type /*raw*/) { return &read_buffer; }
+    Request* read_target(Request* request, std::false_type /*raw*/) { return request; }
+
+    void start() override {
+        read_state.read_next();
+        ServerStreamRpcConnection<Response>::start();
+    }
+
+    void close() override {
+        read_state.close();
+        ServerStreamRpcConnection<Response>::close();
+    }
+
+    void read_completed(bool ok) override {
+        if (Raw && ok
+            && !grpc::SerializationTraits<Request>::Deserialize(&read_buffer, read_state.request.get()).ok()) {
+            read_state.close();
+            stream.finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "The request couldn't be parsed"));
+            return;
+        }
+
+        read_state.read_completed(ok, [this] {
+            if (read_done_callback) {
+                read_done_callback();
+            }
+        });
+    }
+
+    void stream_write(const grpc::ByteBuffer& buffer, grpc::WriteOptions options) override {
+        HELLO_TRACE_SPAN("Write", "grpc");
+        responder.Write(write_message(buffer), options, Tagger::make_tag(&this->processing_tag));
+    }
+
+    void stream_write_and_finish(const grpc::ByteBuffer& buffer, const grpc::Status& final_status) override {
+        responder.WriteAndFinish(
+            write_message(buffer), grpc::WriteOptions{}, final_status, Tagger::make_tag(&this->processing_tag));
+    }
+
+    void stream_finish(const grpc::Status& final_status) override {
+        responder.Finish(final_status, Tagger::make_tag(&this->processing_tag));
+    }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+template struct BidiStreamRpcConnection<testing::proto::EchoRequest, testing::proto::EchoResponse>;
+template struct BidiStreamRpcConnection<testing::proto::EchoRequest, testing::proto::EchoResponse, false>;
+#endif
+
+/**
+ * @brief Adds the request message to a connection type.
+ *
+ *     `Arena` is either `CallArena` or `NoCallArena`. It is the first base class so the arena exists
+ *     before any of the connection's messages are created on it.
+ *
+ * @tparam Request
+ * @tparam RpcConnection - `UnaryRpcConnection` or `ServerWriterRpcConnection`
+ * @tparam Arena
+ */
+template <typename Request, typename RpcConnection, typename Arena>
+struct ConnectionWithRequest : Arena, RpcConnection {
+    CallMessage<Request> request;
+
+    explicit ConnectionWithRequest(const RpcOptions& options)
+        : RpcConnection(Arena::arena(), options), request(Arena::arena()) {}
+    ~ConnectionWithRequest() override = default;
+
+    // Where gRPC puts the request when the call arrives
+    Request* requested() { return request.get(); }
+
+    template <typename ConnectCallback>
+    void connect(ConnectCallback& connect_callback) {
+        RpcConnection::connect(*request, connect_callback);
+    }
+};
+
+/**
+ * @brief Adds the request message to a connection for a raw method, whose request gRPC hands over as
+ *        bytes. It is parsed before the connect callback runs and calls with a request that doesn't
+ *        parse are refused with `INVALID_ARGUMENT`.
+ *
+ * @tparam Request
+ * @tparam RpcConnection - `ServerWriterRpcConnection`
+ * @tparam Arena
+ */
+template <typename Request, typename RpcConnection, typename Arena>
+struct ConnectionWithRawRequest : ConnectionWithRequest<Request, RpcConnection, Arena> {
+    grpc::ByteBuffer raw_request;
+
+    explicit ConnectionWithRawRequest(const RpcOptions& options)
+        : ConnectionWithRequest<Request, RpcConnection, Arena>(options) {}
+    ~ConnectionWithRawRequest() override = default;
+
+    grpc::ByteBuffer* requested() { return &raw_request; }
+
+    template <typename ConnectCallback>
+    void connect(ConnectCallback& connect_callback) {
+        if (!grpc::SerializationTraits<Request>::Deserialize(&raw_request, this->request.get()).ok()) {
+            this->rejected = true;
+            this->reject(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "The request couldn't be parsed"));
+            return;
+        }
+        ConnectionWithRequest<Request, RpcConnection, Arena>::connect(connect_callback);
+    }
+};
+
+/**
+ * @brief Gives a streaming connection that reads its requests from the client (`ClientStreamRpcConnection`
+ *        or `BidiStreamRpcConnection`) its arena.
+ */
+template <typename RpcConnection, typename Arena>
+struct ConnectionWithArena : Arena, RpcConnection {
+    explicit ConnectionWithArena(const RpcOptions& options) : RpcConnection(Arena::arena(), options) {}
+    ~ConnectionWithArena() override = default;
+
+    template <typename ConnectCallback>
+    void connect(ConnectCallback& connect_callback) {
+        connect_callback(RpcConnection::callback_response());
+    }
+};
+
 } // namespace detail
 
+template <typename Response>
+UnaryResponder<Response>::UnaryResponder(std::shared_ptr<detail::DeferredResponse<Response>> deferred)
+    : deferred_(std::move(deferred)) {}
+
+template <typename Response>
+Response* UnaryResponder<Response>::response() const {
+    return deferred_->response();
+}
+
+template <typename Response>
+void UnaryResponder<Response>::finish(const grpc::Status& status) const {
+    deferred_->finish(status);
+}
+
+template <typename Response>
+bool UnaryResponder<Response>::cancelled() const {
+    return deferred_->cancelled();
+}
+
 template <typename Response>
 ServerToClientStream<Response>::ServerToClientStream(detail::ServerStreamRpcConnection<Response>* connection)
     : connection_(connection) {}
 
 template <typename Response>
-void ServerToClientStream<Response>::write(const Response& response) {
-    if (connection_->state == detail::ProcessState::finished) {
-        return;
+bool ServerToClientStream<Response>::write(const Response& response) {
+    // Serialize before taking the lock so producers don't hold up the completion queue thread
+    SerializedMessage<Response> serialized(response);
+    std::size_t bytes = serialized.bytes();
+
+    std::unique_lock<std::mutex> lock(connection_->mutex);
+    return connection_->enqueue(std::move(serialized).buffer(), bytes, &lock);
+}
+
+template <typename Response>
+bool ServerToClientStream<Response>::write(const SerializedMessage<Response>& response) {
+    std::unique_lock<std::mutex> lock(connection_->mutex);
+    return connection_->enqueue(response.buffer(), response.bytes(), &lock);
+}
+
+template <typename Response>
+template <typename Fill>
+bool ServerToClientStream<Response>::emplace(Fill&& fill) {
+    detail::CallArena arena;
+    detail::CallMessage<Response> response(arena.arena());
+
+    std::forward<Fill>(fill)(*response);
+    return write(*response);
+}
+
+template <typename Response>
+template <typename Range>
+std::size_t ServerToClientStream<Response>::write_all(const Range& responses) {
+    std::vector<SerializedMessage<Response>> serialized;
+
+    for (const auto& response : responses) {
+        serialized.emplace_back(response);
     }
 
-    // If there are no responses queued then write directly to the stream
-    if (connection_->queue.empty()) {
-        connection_->responder.Write(response,
-                                     connection_->tagger->make_tag(detail::TagLabel::processing, connection_));
+    std::unique_lock<std::mutex> lock(connection_->mutex);
+
+    std::size_t written = 0u;
+    for (auto& response : serialized) {
+        std::size_t bytes = response.bytes();
+
+        if (connection_->enqueue(std::move(response).buffer(), bytes, &lock)) {
+            ++written;
+        }
     }
-    // Queue the current response until it is processed by the server queue
-    connection_->queue.push(response);
+    return written;
 }
 
 template <typename Response>
 void ServerToClientStream<Response>::finish(const grpc::Status& status) {
-    if (connection_->state == detail::ProcessState::finished) {
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+
+    if (connection_->state == detail::ProcessState::finished || connection_->status != nullptr) {
         return;
     }
+    connection_->finish_code = status.error_code();
 
     // If there are no responses queued then write directly to the stream
     if (connection_->queue.empty()) {
-        connection_->responder.Finish(status, connection_->tagger->make_tag(detail::TagLabel::processing, connection_));
+        connection_->stream_finish(status);
         connection_->state = detail::ProcessState::finished;
     } else {
         // Otherwise save the status to be processed when there are no more responses queued
@@ -178,9 +1371,79 @@ void ServerToClientStream<Response>::finish(const grpc::Status& status) {
     }
 }
 
+template <typename Response>
+void ServerToClientStream<Response>::on_drained(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+    connection_->drained_callback = std::move(callback);
+}
+
 template <typename Response>
 std::unique_ptr<grpc::Status> ServerToClientStream<Response>::status() {
+    std::lock_guard<std::mutex> lock(connection_->mutex);
     return std::move(connection_->status);
 }
 
+template <typename Response>
+std::size_t ServerToClientStream<Response>::queued_messages() {
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+    return connection_->queue.size();
+}
+
+template <typename Response>
+std::size_t ServerToClientStream<Response>::queued_bytes() {
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+    return connection_->queued_bytes;
+}
+
+template <typename Request>
+StreamReader<Request>::StreamReader(detail::StreamReadState<Request>* state) : state_(state) {}
+
+template <typename Request>
+void StreamReader<Request>::on_read(std::function<void(const Request&)> callback) {
+    state_->read_callback = std::move(callback);
+}
+
+template <typename Request>
+void StreamReader<Request>::pause_reading() {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->paused = true;
+}
+
+template <typename Request>
+void StreamReader<Request>::resume_reading() {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->paused = false;
+    }
+    state_->read_next();
+}
+
+template <typename Request, typename Response>
+ClientToServerStream<Request, Response>::ClientToServerStream(
+    detail::ClientStreamRpcConnection<Request, Response>* connection)
+    : StreamReader<Request>(&connection->read_state), connection_(connection) {}
+
+template <typename Request, typename Response>
+void ClientToServerStream<Request, Response>::on_read_done(std::function<grpc::Status(Response*)> callback) {
+    connection_->read_done_callback = std::move(callback);
+}
+
+template <typename Request, typename Response>
+void ClientToServerStream<Request, Response>::finish(const grpc::Status& status) {
+    connection_->finish(status);
+}
+
+template <typename Request, typename Response>
+BidiStream<Request, Response>::BidiStream(detail::ServerStreamRpcConnection<Response>* connection,
+                                          detail::StreamReadState<Request>* read_state,
+                                          std::function<void()>* read_done_callback)
+    : ServerToClientStream<Response>(connection),
+      StreamReader<Request>(read_state),
+      read_done_callback_(read_done_callback) {}
+
+template <typename Request, typename Response>
+void BidiStream<Request, Response>::on_read_done(std::function<void()> callback) {
+    *read_done_callback_ = std::move(callback);
+}
+
 } // namespace net
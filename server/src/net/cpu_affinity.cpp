@@ -0,0 +1,154 @@
+#include "cpu_affinity.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// system
+#include <pthread.h>
+#include <sched.h>
+
+// standard
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace net {
+namespace {
+
+const std::string numa_node_directory = "/sys/devices/system/node/";
+
+/**
+ * @brief The first line of a sysfs file, or an empty string if it can't be read.
+ */
+std::string read_line(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+unsigned parse_cpu(const std::string& list, const std::string& cpu) {
+    if (cpu.empty() || cpu.find_first_not_of("0123456789") != std::string::npos) {
+        throw std::invalid_argument("Invalid CPU list '" + list + "'");
+    }
+    return static_cast<unsigned>(std::stoul(cpu));
+}
+
+} // namespace
+
+std::vector<unsigned> parse_cpu_list(const std::string& list) {
+    std::vector<unsigned> cpus;
+    std::size_t start = 0u;
+
+    while (start < list.size()) {
+        std::size_t end = std::min(list.find(',', start), list.size());
+        std::string range = list.substr(start, end - start);
+        std::size_t dash = range.find('-');
+
+        unsigned first = parse_cpu(list, range.substr(0u, dash));
+        unsigned last = dash == std::string::npos ? first : parse_cpu(list, range.substr(dash + 1u));
+
+        if (last < first) {
+            throw std::invalid_argument("Invalid CPU list '" + list + "'");
+        }
+        for (unsigned cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+        start = end + 1u;
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::vector<unsigned> allowed_cpus() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+
+    int result = pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed);
+    if (result != 0) {
+        throw std::system_error(result, std::generic_category(), "Failed to get the allowed CPUs");
+    }
+
+    std::vector<unsigned> cpus;
+    for (unsigned cpu = 0u; cpu < static_cast<unsigned>(CPU_SETSIZE); ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<unsigned> numa_nodes() {
+    std::string online = read_line(numa_node_directory + "online");
+    return online.empty() ? std::vector<unsigned>{0u} : parse_cpu_list(online);
+}
+
+std::vector<unsigned> numa_node_cpus(unsigned node) {
+    std::vector<unsigned> allowed = allowed_cpus();
+    std::string node_cpus = read_line(numa_node_directory + "node" + std::to_string(node) + "/cpulist");
+
+    if (node_cpus.empty()) {
+        if (node == 0u && read_line(numa_node_directory + "online").empty()) {
+            return allowed;
+        }
+        throw std::invalid_argument("NUMA node " + std::to_string(node) + " doesn't exist");
+    }
+
+    std::vector<unsigned> cpus;
+    std::vector<unsigned> on_node = parse_cpu_list(node_cpus);
+    std::set_intersection(on_node.begin(), on_node.end(), allowed.begin(), allowed.end(), std::back_inserter(cpus));
+    return cpus;
+}
+
+void pin_current_thread(const std::vector<unsigned>& cpus) {
+    if (cpus.empty()) {
+        throw std::invalid_argument("A thread can't be pinned to no CPUs");
+    }
+
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    for (unsigned cpu : cpus) {
+        if (cpu >= static_cast<unsigned>(CPU_SETSIZE)) {
+            throw std::invalid_argument("CPU " + std::to_string(cpu) + " is out of range");
+        }
+        CPU_SET(cpu, &pinned);
+    }
+
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+    if (result != 0) {
+        throw std::system_error(result, std::generic_category(), "Failed to pin the thread to its CPUs");
+    }
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("[net] test CPU lists are parsed and threads pinned to them") {
+    CHECK(parse_cpu_list("") == std::vector<unsigned>{});
+    CHECK(parse_cpu_list("3") == std::vector<unsigned>{3u});
+    CHECK(parse_cpu_list("8,0-2,10-11,1") == std::vector<unsigned>{0u, 1u, 2u, 8u, 10u, 11u});
+
+    CHECK_THROWS_AS(parse_cpu_list("1-"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_cpu_list("3-1"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_cpu_list("a"), std::invalid_argument);
+
+    std::vector<unsigned> allowed = allowed_cpus();
+    REQUIRE_FALSE(allowed.empty());
+    CHECK_FALSE(numa_node_cpus(numa_nodes().front()).empty());
+
+    // Pinned on its own thread so the test runner keeps every CPU
+    std::thread([&allowed] {
+        pin_current_thread({allowed.back()});
+        CHECK(allowed_cpus() == std::vector<unsigned>{allowed.back()});
+        CHECK(sched_getcpu() == static_cast<int>(allowed.back()));
+    }).join();
+
+    CHECK(allowed_cpus() == allowed);
+    CHECK_THROWS_AS(pin_current_thread({}), std::invalid_argument);
+}
+#endif
+
+} // namespace net
@@ -0,0 +1,36 @@
+#pragma once
+
+// standard
+#include <string>
+#include <vector>
+
+namespace net {
+
+/**
+ * @brief Parses a Linux CPU list like "0-3,8,10-11" (the format of `taskset -c` and the files under
+ *        /sys/devices/system/node) into the CPUs it lists, in increasing order.
+ */
+std::vector<unsigned> parse_cpu_list(const std::string& list);
+
+/**
+ * @brief The CPUs the calling thread is allowed to run on.
+ */
+std::vector<unsigned> allowed_cpus();
+
+/**
+ * @brief The NUMA nodes that are online. Just node 0 when the kernel doesn't report any.
+ */
+std::vector<unsigned> numa_nodes();
+
+/**
+ * @brief The CPUs of NUMA node `node` that the calling thread is allowed to run on. Without NUMA
+ *        support every allowed CPU belongs to node 0.
+ */
+std::vector<unsigned> numa_node_cpus(unsigned node);
+
+/**
+ * @brief Restricts the calling thread to `cpus`. Threads it starts afterwards inherit the restriction.
+ */
+void pin_current_thread(const std::vector<unsigned>& cpus);
+
+} // namespace net
@@ -0,0 +1,185 @@
+#pragma once
+
+// standard
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace net {
+namespace detail {
+
+/**
+ * @brief Values below `sub_buckets` nanoseconds get a bucket each. Above that every power of two is
+ *        split into `sub_buckets` equal buckets, so a value's bucket is within about 3% of it.
+ */
+struct LatencyBuckets {
+    static constexpr unsigned sub_bucket_bits = 5u;
+    static constexpr std::uint64_t sub_buckets = 1u << sub_bucket_bits;
+    static constexpr std::size_t count = sub_buckets * (64u - sub_bucket_bits + 1u);
+
+    static std::size_t bucket(std::uint64_t value) {
+        if (value < sub_buckets) {
+            return static_cast<std::size_t>(value);
+        }
+
+        // How far the value has to be shifted to leave `sub_bucket_bits + 1` significant bits
+        unsigned shift = 0u;
+        while ((value >> shift) >= 2u * sub_buckets) {
+            ++shift;
+        }
+        return static_cast<std::size_t>(sub_buckets * (shift + 1u) + ((value >> shift) - sub_buckets));
+    }
+
+    /**
+     * @brief The largest value that goes in bucket `index`
+     */
+    static std::uint64_t bucket_end(std::size_t index) {
+        if (index < sub_buckets) {
+            return index;
+        }
+        std::uint64_t shift = index / sub_buckets - 1u;
+        std::uint64_t mantissa = sub_buckets + index % sub_buckets;
+        return ((mantissa + 1u) << shift) - 1u;
+    }
+
+    static std::uint64_t to_nanoseconds(std::chrono::nanoseconds latency) {
+        return static_cast<std::uint64_t>(std::max(latency.count(), std::chrono::nanoseconds::rep{0}));
+    }
+
+    static std::chrono::nanoseconds to_duration(std::uint64_t value) {
+        return std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(value)};
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief Counts latencies in buckets whose width grows with the latency, so every recorded value
+ *        is kept to within about 3% using a few KB no matter how many are recorded.
+ *
+ *     Not thread safe. Use `AtomicLatencyHistogram` to record from several threads.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts_(detail::LatencyBuckets::count, 0u) {}
+
+    void record(std::chrono::nanoseconds latency) {
+        std::uint64_t value = detail::LatencyBuckets::to_nanoseconds(latency);
+
+        ++counts_[detail::LatencyBuckets::bucket(value)];
+        ++count_;
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (auto i = 0u; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    std::uint64_t count() const { return count_; }
+
+    std::chrono::nanoseconds sum() const { return detail::LatencyBuckets::to_duration(sum_); }
+
+    std::chrono::nanoseconds max() const { return detail::LatencyBuckets::to_duration(max_); }
+
+    std::chrono::nanoseconds mean() const {
+        return detail::LatencyBuckets::to_duration(count_ == 0u ? 0u : sum_ / count_);
+    }
+
+    /**
+     * @brief The latency `fraction` (0 to 1) of the recorded values are at or below, rounded up to
+     *        the end of its bucket.
+     */
+    std::chrono::nanoseconds percentile(double fraction) const {
+        if (count_ == 0u) {
+            return std::chrono::nanoseconds{0};
+        }
+
+        auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count_) + 0.5);
+        rank = std::min(std::max(rank, std::uint64_t{1u}), count_);
+
+        std::uint64_t seen = 0u;
+        for (auto i = 0u; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return detail::LatencyBuckets::to_duration(std::min(detail::LatencyBuckets::bucket_end(i), max_));
+            }
+        }
+        return max();
+    }
+
+    /**
+     * @brief The number of recorded values at or below `latency` (rounded to its bucket)
+     */
+    std::uint64_t count_at_or_below(std::chrono::nanoseconds latency) const {
+        std::size_t last = detail::LatencyBuckets::bucket(detail::LatencyBuckets::to_nanoseconds(latency));
+
+        std::uint64_t seen = 0u;
+        for (auto i = 0u; i <= last; ++i) {
+            seen += counts_[i];
+        }
+        return seen;
+    }
+
+private:
+    friend class AtomicLatencyHistogram;
+
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t count_ = 0u;
+    std::uint64_t sum_ = 0u;
+    std::uint64_t max_ = 0u;
+};
+
+/**
+ * @brief A `LatencyHistogram` that can be recorded to from any thread without locking.
+ *
+ *     Every value is a relaxed atomic increment, so a snapshot taken while values are being recorded
+ *     may be a few values behind but is never torn in a way that matters for monitoring.
+ */
+class AtomicLatencyHistogram {
+public:
+    AtomicLatencyHistogram() {
+        for (auto& count : counts_) {
+            count.store(0u, std::memory_order_relaxed);
+        }
+    }
+
+    void record(std::chrono::nanoseconds latency) {
+        std::uint64_t value = detail::LatencyBuckets::to_nanoseconds(latency);
+
+        counts_[detail::LatencyBuckets::bucket(value)].fetch_add(1u, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+
+        std::uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    LatencyHistogram snapshot() const {
+        LatencyHistogram histogram;
+
+        for (auto i = 0u; i < counts_.size(); ++i) {
+            histogram.counts_[i] = counts_[i].load(std::memory_order_relaxed);
+            histogram.count_ += histogram.counts_[i];
+        }
+        histogram.sum_ = sum_.load(std::memory_order_relaxed);
+        histogram.max_ = max_.load(std::memory_order_relaxed);
+        return histogram;
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, detail::LatencyBuckets::count> counts_;
+    std::atomic<std::uint64_t> sum_{0u};
+    std::atomic<std::uint64_t> max_{0u};
+};
+
+} // namespace net
@@ -0,0 +1,261 @@
+#include "metrics.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// standard
+#include <algorithm>
+#include <sstream>
+
+namespace net {
+namespace {
+
+// The histogram buckets exported to Prometheus, in seconds
+constexpr std::array<double, 17u> exported_latency_buckets = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+
+// Escapes a Prometheus label value
+std::string label_value(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+void write_header(std::ostream& out, const std::string& name, const char* type, const char* help) {
+    out << "# HELP " << name << ' ' << help << '\n' << "# TYPE " << name << ' ' << type << '\n';
+}
+
+} // namespace
+
+std::uint64_t RpcMetrics::calls_finished() const {
+    std::uint64_t finished = 0u;
+    for (std::uint64_t count : calls_finished_by_code) {
+        finished += count;
+    }
+    return finished;
+}
+
+std::uint64_t RpcMetrics::calls_in_flight() const {
+    std::uint64_t finished = calls_finished();
+    return calls_started > finished ? calls_started - finished : 0u;
+}
+
+std::uint64_t RpcMetrics::errors() const {
+    return calls_finished() - calls_finished_by_code[static_cast<std::size_t>(grpc::StatusCode::OK)];
+}
+
+const char* status_code_name(grpc::StatusCode code) {
+    static constexpr std::array<const char*, num_status_codes> names = {"OK",
+                                                                        "CANCELLED",
+                                                                        "UNKNOWN",
+                                                                        "INVALID_ARGUMENT",
+                                                                        "DEADLINE_EXCEEDED",
+                                                                        "NOT_FOUND",
+                                                                        "ALREADY_EXISTS",
+                                                                        "PERMISSION_DENIED",
+                                                                        "RESOURCE_EXHAUSTED",
+                                                                        "FAILED_PRECONDITION",
+                                                                        "ABORTED",
+                                                                        "OUT_OF_RANGE",
+                                                                        "UNIMPLEMENTED",
+                                                                        "INTERNAL",
+                                                                        "UNAVAILABLE",
+                                                                        "DATA_LOSS",
+                                                                        "UNAUTHENTICATED"};
+
+    auto index = static_cast<std::size_t>(code);
+    return index < names.size() ? names[index] : "UNKNOWN";
+}
+
+std::string to_prometheus_text(const ServerMetrics& metrics, const std::string& prefix) {
+    std::ostringstream out;
+
+    std::string name = prefix + "_uptime_seconds";
+    write_header(out, name, "gauge", "Time since the server started.");
+    out << name << ' ' << metrics.uptime.count() << '\n';
+
+    name = prefix + "_completion_queue_events_total";
+    write_header(out, name, "counter", "Events taken off each completion queue.");
+    for (auto i = 0u; i < metrics.completion_queue_events.size(); ++i) {
+        out << name << "{queue=\"" << i << "\"} " << metrics.completion_queue_events[i] << '\n';
+    }
+
+    name = prefix + "_rpc_calls_started_total";
+    write_header(out, name, "counter", "Calls accepted for each RPC.");
+    for (const auto& rpc : metrics.rpcs) {
+        out << name << "{rpc=\"" << label_value(rpc.name) << "\"} " << rpc.calls_started << '\n';
+    }
+
+    name = prefix + "_rpc_calls_finished_total";
+    write_header(out, name, "counter", "Calls that are done for each RPC, by status code.");
+    for (const auto& rpc : metrics.rpcs) {
+        for (auto code = 0u; code < num_status_codes; ++code) {
+            if (rpc.calls_finished_by_code[code] != 0u) {
+                out << name << "{rpc=\"" << label_value(rpc.name) << "\",code=\""
+                    << status_code_name(static_cast<grpc::StatusCode>(code)) << "\"} "
+                    << rpc.calls_finished_by_code[code] << '\n';
+            }
+        }
+    }
+
+    name = prefix + "_rpc_calls_in_flight";
+    write_header(out, name, "gauge", "Calls that have been accepted and aren't done yet.");
+    for (const auto& rpc : metrics.rpcs) {
+        out << name << "{rpc=\"" << label_value(rpc.name) << "\"} " << rpc.calls_in_flight() << '\n';
+    }
+
+    name = prefix + "_rpc_latency_seconds";
+    write_header(out, name, "histogram", "Time from a call being accepted until it is done.");
+    for (const auto& rpc : metrics.rpcs) {
+        std::string labels = "rpc=\"" + label_value(rpc.name) + "\"";
+
+        for (double bucket : exported_latency_buckets) {
+            auto le = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(bucket));
+            out << name << "_bucket{" << labels << ",le=\"" << bucket << "\"} " << rpc.latency.count_at_or_below(le)
+                << '\n';
+        }
+        out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << rpc.latency.count() << '\n';
+        out << name << "_sum{" << labels << "} " << std::chrono::duration<double>(rpc.latency.sum()).count() << '\n';
+        out << name << "_count{" << labels << "} " << rpc.latency.count() << '\n';
+    }
+
+    name = prefix + "_rpc_send_queue_messages";
+    write_header(out, name, "gauge", "Responses queued on the RPC's streams that haven't been sent.");
+    for (const auto& rpc : metrics.rpcs) {
+        out << name << "{rpc=\"" << label_value(rpc.name) << "\"} " << rpc.queued_messages << '\n';
+    }
+
+    name = prefix + "_rpc_send_queue_bytes";
+    write_header(out, name, "gauge", "Serialized size of the responses counted by send_queue_messages.");
+    for (const auto& rpc : metrics.rpcs) {
+        out << name << "{rpc=\"" << label_value(rpc.name) << "\"} " << rpc.queued_bytes << '\n';
+    }
+
+    name = prefix + "_rpc_max_stream_send_queue_messages";
+    write_header(out, name, "gauge", "The most responses ever queued on any one of the RPC's streams.");
+    for (const auto& rpc : metrics.rpcs) {
+        out << name << "{rpc=\"" << label_value(rpc.name) << "\"} " << rpc.max_stream_queued_messages << '\n';
+    }
+
+    return out.str();
+}
+
+namespace detail {
+
+RpcCounters::RpcCounters() {
+    for (auto& count : calls_finished_by_code_) {
+        count.store(0u, std::memory_order_relaxed);
+    }
+}
+
+void RpcCounters::call_started() {
+    calls_started_.fetch_add(1u, std::memory_order_relaxed);
+}
+
+void RpcCounters::call_finished(grpc::StatusCode code, std::chrono::nanoseconds latency) {
+    auto index = static_cast<std::size_t>(code);
+    if (index >= num_status_codes) {
+        index = static_cast<std::size_t>(grpc::StatusCode::UNKNOWN);
+    }
+
+    calls_finished_by_code_[index].fetch_add(1u, std::memory_order_relaxed);
+    latency_.record(latency);
+}
+
+void RpcCounters::response_queued(std::size_t bytes, std::size_t depth) {
+    queued_messages_.fetch_add(1u, std::memory_order_relaxed);
+    queued_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+
+    std::size_t deepest = max_stream_queued_messages_.load(std::memory_order_relaxed);
+    while (depth > deepest
+           && !max_stream_queued_messages_.compare_exchange_weak(deepest, depth, std::memory_order_relaxed)) {
+    }
+}
+
+void RpcCounters::responses_unqueued(std::size_t messages, std::size_t bytes) {
+    queued_messages_.fetch_sub(messages, std::memory_order_relaxed);
+    queued_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void RpcCounters::add_to(RpcMetrics* metrics) const {
+    metrics->calls_started += calls_started_.load(std::memory_order_relaxed);
+
+    for (auto i = 0u; i < num_status_codes; ++i) {
+        metrics->calls_finished_by_code[i] += calls_finished_by_code_[i].load(std::memory_order_relaxed);
+    }
+    metrics->latency.merge(latency_.snapshot());
+
+    metrics->queued_messages += queued_messages_.load(std::memory_order_relaxed);
+    metrics->queued_bytes += queued_bytes_.load(std::memory_order_relaxed);
+    metrics->max_stream_queued_messages = std::max(metrics->max_stream_queued_messages,
+                                                   max_stream_queued_messages_.load(std::memory_order_relaxed));
+}
+
+} // namespace detail
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("[net] test latency histogram percentiles stay within their buckets") {
+    LatencyHistogram histogram;
+
+    for (int micros = 1; micros <= 1000; ++micros) {
+        histogram.record(std::chrono::microseconds(micros));
+    }
+
+    CHECK(histogram.count() == 1000u);
+    CHECK(histogram.max() == std::chrono::microseconds(1000));
+
+    auto p50 = std::chrono::duration<double, std::micro>(histogram.percentile(0.5)).count();
+    auto p99 = std::chrono::duration<double, std::micro>(histogram.percentile(0.99)).count();
+
+    CHECK(p50 >= 500.0);
+    CHECK(p50 <= 500.0 * 1.04);
+    CHECK(p99 >= 990.0);
+    CHECK(p99 <= 990.0 * 1.04);
+
+    std::uint64_t below = histogram.count_at_or_below(std::chrono::microseconds(100));
+    CHECK(below >= 100u);
+    CHECK(below <= 104u);
+}
+
+TEST_CASE("[net] test prometheus text has every rpc's counters") {
+    detail::RpcCounters counters;
+    counters.call_started();
+    counters.call_started();
+    counters.call_finished(grpc::StatusCode::OK, std::chrono::milliseconds(2));
+
+    // Two streams queue three responses between them and one is sent
+    counters.response_queued(10u, 1u);
+    counters.response_queued(20u, 2u);
+    counters.response_queued(5u, 1u);
+    counters.responses_unqueued(1u, 10u);
+
+    ServerMetrics metrics{};
+    metrics.completion_queue_events = {7u};
+    metrics.rpcs.emplace_back();
+    metrics.rpcs.back().name = "Say\"Hello\"";
+    counters.add_to(&metrics.rpcs.back());
+
+    std::string text = to_prometheus_text(metrics, "test");
+
+    CHECK(text.find("test_completion_queue_events_total{queue=\"0\"} 7\n") != std::string::npos);
+    CHECK(text.find("test_rpc_calls_started_total{rpc=\"Say\\\"Hello\\\"\"} 2\n") != std::string::npos);
+    CHECK(text.find("test_rpc_calls_finished_total{rpc=\"Say\\\"Hello\\\"\",code=\"OK\"} 1\n") != std::string::npos);
+    CHECK(text.find("test_rpc_calls_in_flight{rpc=\"Say\\\"Hello\\\"\"} 1\n") != std::string::npos);
+    CHECK(text.find("test_rpc_latency_seconds_bucket{rpc=\"Say\\\"Hello\\\"\",le=\"0.001\"} 0\n") != std::string::npos);
+    CHECK(text.find("test_rpc_latency_seconds_bucket{rpc=\"Say\\\"Hello\\\"\",le=\"0.0025\"} 1\n") != std::string::npos);
+    CHECK(text.find("test_rpc_send_queue_messages{rpc=\"Say\\\"Hello\\\"\"} 2\n") != std::string::npos);
+    CHECK(text.find("test_rpc_send_queue_bytes{rpc=\"Say\\\"Hello\\\"\"} 25\n") != std::string::npos);
+    CHECK(text.find("test_rpc_max_stream_send_queue_messages{rpc=\"Say\\\"Hello\\\"\"} 2\n") != std::string::npos);
+}
+#endif
+
+} // namespace net
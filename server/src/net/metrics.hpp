@@ -0,0 +1,108 @@
+#pragma once
+
+// project
+#include "net/latency_histogram.hpp"
+
+// third-party
+#include <grpcpp/support/status_code_enum.h>
+
+// standard
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace net {
+
+/**
+ * @brief The number of `grpc::StatusCode`s (`OK` through `UNAUTHENTICATED`)
+ */
+constexpr std::size_t num_status_codes = 17u;
+
+/**
+ * @brief What one registered RPC has done, summed over every completion queue.
+ */
+struct RpcMetrics {
+    std::string name; // `RpcOptions::name`
+
+    std::uint64_t calls_started = 0u;
+    std::array<std::uint64_t, num_status_codes> calls_finished_by_code{}; // Indexed by `grpc::StatusCode`
+
+    // From a call being accepted until gRPC reports it done (including sending every streamed response)
+    LatencyHistogram latency;
+
+    // Responses written to the RPC's streams that their clients haven't received yet
+    std::size_t queued_messages = 0u;
+    std::size_t queued_bytes = 0u;
+    std::size_t max_stream_queued_messages = 0u; // The most ever queued on any one stream
+
+    std::uint64_t calls_finished() const;
+    std::uint64_t calls_in_flight() const;
+    std::uint64_t errors() const;
+};
+
+/**
+ * @brief A snapshot of everything `AsyncServer` counts.
+ */
+struct ServerMetrics {
+    std::chrono::duration<double> uptime{0.0};
+
+    // Events taken off each completion queue. The change between two snapshots over the time between
+    // them gives each queue's events per second.
+    std::vector<std::uint64_t> completion_queue_events;
+
+    std::vector<RpcMetrics> rpcs; // In the order they were registered
+};
+
+/**
+ * @brief The name of a status code as used by gRPC (e.g. "DEADLINE_EXCEEDED")
+ */
+const char* status_code_name(grpc::StatusCode code);
+
+/**
+ * @brief Formats `metrics` in the Prometheus text exposition format with every metric name starting
+ *        with `prefix`.
+ */
+std::string to_prometheus_text(const ServerMetrics& metrics, const std::string& prefix);
+
+namespace detail {
+
+/**
+ * @brief The counters behind one `RpcCall`'s `RpcMetrics`. The call counts are only written by the
+ *        call's completion queue thread and the send queue gauges by whichever thread adds to or
+ *        empties a stream's queue. Nothing needs to be read together, so relaxed atomics are all
+ *        that's needed and snapshots never wait on the streams.
+ */
+class RpcCounters {
+public:
+    RpcCounters();
+
+    void call_started();
+    void call_finished(grpc::StatusCode code, std::chrono::nanoseconds latency);
+
+    /**
+     * @brief Counts a response added to a stream whose queue is `depth` long with it.
+     */
+    void response_queued(std::size_t bytes, std::size_t depth);
+    void responses_unqueued(std::size_t messages, std::size_t bytes);
+
+    /**
+     * @brief Adds the counts so far to `metrics`.
+     */
+    void add_to(RpcMetrics* metrics) const;
+
+private:
+    std::atomic<std::uint64_t> calls_started_{0u};
+    std::array<std::atomic<std::uint64_t>, num_status_codes> calls_finished_by_code_;
+    AtomicLatencyHistogram latency_;
+
+    std::atomic<std::size_t> queued_messages_{0u};
+    std::atomic<std::size_t> queued_bytes_{0u};
+    std::atomic<std::size_t> max_stream_queued_messages_{0u};
+};
+
+} // namespace detail
+} // namespace net
@@ -0,0 +1,182 @@
+#include "metrics_endpoint.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// system
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// standard
+#include <cerrno>
+#include <system_error>
+
+namespace net {
+namespace {
+
+// How long the serving thread waits for a connection before checking whether it should stop
+constexpr int accept_poll_ms = 100;
+
+// Scrapers that connect and then say nothing are dropped after this long
+constexpr int client_timeout_s = 2;
+
+constexpr std::size_t max_request_bytes = 8192u;
+
+std::system_error system_error(const std::string& what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+void send_all(int fd, const std::string& data) {
+    std::size_t sent = 0u;
+    while (sent < data.size()) {
+        ssize_t result = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        sent += static_cast<std::size_t>(result);
+    }
+}
+
+std::string http_response(const char* status, const char* content_type, const std::string& body) {
+    return std::string("HTTP/1.1 ") + status + "\r\nContent-Type: " + content_type
+        + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+}
+
+} // namespace
+
+MetricsEndpoint::MetricsEndpoint(unsigned port, std::function<std::string()> render)
+    : listen_fd_(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)), port_(port), render_(std::move(render)) {
+    if (listen_fd_ < 0) {
+        throw system_error("Failed to create metrics socket");
+    }
+
+    int reuse = 1;
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // Only served locally. Anything further away should go through a scraper on the host.
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || ::listen(listen_fd_, SOMAXCONN) != 0) {
+        std::system_error error = system_error("Failed to listen for metrics on port " + std::to_string(port));
+        ::close(listen_fd_);
+        throw error;
+    }
+
+    socklen_t address_size = sizeof(address);
+    if (::getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &address_size) == 0) {
+        port_ = ntohs(address.sin_port);
+    }
+
+    thread_ = std::thread([this] { serve(); });
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    stopping_ = true;
+    thread_.join();
+    ::close(listen_fd_);
+}
+
+unsigned MetricsEndpoint::port() const {
+    return port_;
+}
+
+void MetricsEndpoint::serve() {
+    while (!stopping_) {
+        pollfd listener{listen_fd_, POLLIN, 0};
+
+        if (::poll(&listener, 1u, accept_poll_ms) <= 0) {
+            continue;
+        }
+
+        int client_fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            continue;
+        }
+
+        timeval timeout{client_timeout_s, 0};
+        ::setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        respond(client_fd);
+        ::close(client_fd);
+    }
+}
+
+void MetricsEndpoint::respond(int client_fd) {
+    std::string request;
+    char buffer[1024];
+
+    // Only the request line matters but the headers are read so the client sees an orderly close
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < max_request_bytes) {
+        ssize_t received = ::recv(client_fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        request.append(buffer, static_cast<std::size_t>(received));
+    }
+
+    std::string request_line = request.substr(0u, request.find("\r\n"));
+
+    if (request_line.compare(0, 13, "GET /metrics ") == 0 || request_line == "GET /metrics") {
+        send_all(client_fd, http_response("200 OK", "text/plain; version=0.0.4; charset=utf-8", render_()));
+    } else {
+        send_all(client_fd, http_response("404 Not Found", "text/plain; charset=utf-8", "Not found\n"));
+    }
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+namespace {
+
+std::string http_get(unsigned port, const std::string& path) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(fd >= 0);
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    REQUIRE(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+
+    send_all(fd, "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+    std::string response;
+    char buffer[1024];
+    ssize_t received;
+    while ((received = ::recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, static_cast<std::size_t>(received));
+    }
+    ::close(fd);
+    return response;
+}
+
+} // namespace
+
+TEST_CASE("[net] test MetricsEndpoint serves the rendered text") {
+    int scrapes = 0;
+    MetricsEndpoint endpoint(/*port=*/0u, [&scrapes] { return "scrapes " + std::to_string(++scrapes) + "\n"; });
+
+    std::string response = http_get(endpoint.port(), "/metrics");
+    CHECK(response.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    CHECK(response.find("\r\n\r\nscrapes 1\n") != std::string::npos);
+
+    CHECK(http_get(endpoint.port(), "/metrics").find("scrapes 2\n") != std::string::npos);
+    CHECK(http_get(endpoint.port(), "/").compare(0, 12, "HTTP/1.1 404") == 0);
+    CHECK(scrapes == 2);
+}
+#endif
+
+} // namespace net
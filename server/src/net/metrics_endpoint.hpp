@@ -0,0 +1,43 @@
+#pragma once
+
+// standard
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace net {
+
+/**
+ * @brief A minimal HTTP endpoint on localhost that answers `GET /metrics` with the text returned by
+ *        `render` (e.g. `to_prometheus_text(server.metrics(), "hello")`).
+ *
+ *     Requests are answered one at a time on the endpoint's own thread, so a scrape never runs on a
+ *     completion queue thread. Anything other than `GET /metrics` gets a 404.
+ */
+class MetricsEndpoint {
+public:
+    /**
+     * @param port - The port to listen on. 0 picks a free port (see `port()`).
+     * @param render - Produces the response body for each scrape
+     */
+    MetricsEndpoint(unsigned port, std::function<std::string()> render);
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    unsigned port() const;
+
+private:
+    int listen_fd_;
+    unsigned port_;
+    std::function<std::string()> render_;
+    std::atomic_bool stopping_{false};
+    std::thread thread_;
+
+    void serve();
+    void respond(int client_fd);
+};
+
+} // namespace net
@@ -0,0 +1,87 @@
+#include "queue_delay_shedder.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// standard
+#include <algorithm>
+#include <stdexcept>
+
+namespace net {
+
+QueueDelayShedder::QueueDelayShedder(std::chrono::nanoseconds target, std::chrono::nanoseconds interval)
+    : target_(target), interval_(interval), min_delay_(std::chrono::nanoseconds::max()) {
+    if (target.count() < 0 || (target.count() != 0 && interval.count() <= 0)) {
+        throw std::invalid_argument("The queue delay target can't be negative and needs a positive interval.");
+    }
+}
+
+void QueueDelayShedder::observe(std::chrono::nanoseconds delay, std::chrono::steady_clock::time_point now) {
+    if (target_.count() == 0) {
+        return;
+    }
+    last_delay_.store(delay.count(), std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    min_delay_ = std::min(min_delay_, delay);
+
+    // The first observation only starts the first interval
+    if (interval_end_ == std::chrono::steady_clock::time_point{}) {
+        interval_end_ = now + interval_;
+        return;
+    }
+
+    if (now >= interval_end_) {
+        overloaded_.store(min_delay_ > target_, std::memory_order_relaxed);
+        min_delay_ = std::chrono::nanoseconds::max();
+        interval_end_ = now + interval_;
+    }
+}
+
+bool QueueDelayShedder::overloaded() const {
+    return overloaded_.load(std::memory_order_relaxed);
+}
+
+bool QueueDelayShedder::should_shed() const {
+    return overloaded() && last_delay_.load(std::memory_order_relaxed) > 2 * target_.count();
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("[net] test QueueDelayShedder only sheds once the delay stops draining") {
+    using namespace std::chrono_literals;
+
+    QueueDelayShedder shedder(/*target=*/5ms, /*interval=*/100ms);
+    auto now = std::chrono::steady_clock::now();
+
+    // A burst that drains before the interval ends isn't overload
+    shedder.observe(1ms, now);
+    shedder.observe(50ms, now + 40ms);
+    shedder.observe(2ms, now + 80ms);
+    shedder.observe(50ms, now + 100ms);
+    CHECK_FALSE(shedder.overloaded());
+    CHECK_FALSE(shedder.should_shed());
+
+    // A full interval above the target is
+    shedder.observe(20ms, now + 150ms);
+    shedder.observe(8ms, now + 200ms);
+    CHECK(shedder.overloaded());
+    CHECK_FALSE(shedder.should_shed());
+
+    shedder.observe(30ms, now + 210ms);
+    CHECK(shedder.should_shed());
+
+    // Until the delay comes back down for an interval
+    shedder.observe(1ms, now + 250ms);
+    CHECK(shedder.overloaded());
+    shedder.observe(1ms, now + 300ms);
+    CHECK_FALSE(shedder.overloaded());
+    CHECK_FALSE(shedder.should_shed());
+
+    QueueDelayShedder disabled(/*target=*/0ms, /*interval=*/100ms);
+    disabled.observe(1s, now);
+    disabled.observe(1s, now + 1s);
+    CHECK_FALSE(disabled.should_shed());
+}
+#endif
+
+} // namespace net
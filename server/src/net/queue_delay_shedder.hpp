@@ -0,0 +1,53 @@
+#pragma once
+
+// standard
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace net {
+
+/**
+ * @brief Decides when new calls should be turned away because work is waiting too long to be started,
+ *        following CoDel (Controlled Delay).
+ *
+ *     A queue that is merely busy drains between bursts, so the shortest delay seen over an interval
+ *     stays low. Only when even that shortest delay is above the target has the queue stopped draining,
+ *     and the server is overloaded until an interval goes by with a delay at or under the target.
+ *     While overloaded, calls are shed whenever the latest delay is more than twice the target, which
+ *     keeps the delay (and so the latency of the calls that are accepted) bounded instead of letting
+ *     every call slow down together.
+ *
+ *     Delays can be observed from any thread. `should_shed` doesn't take a lock.
+ */
+class QueueDelayShedder {
+public:
+    /**
+     * @param target - The delay the queue is allowed to settle at. Disabled if 0.
+     * @param interval - How long the delay has to stay above the target before calls are shed. Should be
+     *                   a few times longer than it takes to handle a call.
+     */
+    QueueDelayShedder(std::chrono::nanoseconds target, std::chrono::nanoseconds interval);
+
+    QueueDelayShedder(const QueueDelayShedder&) = delete;
+    QueueDelayShedder& operator=(const QueueDelayShedder&) = delete;
+
+    void observe(std::chrono::nanoseconds delay,
+                 std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    bool overloaded() const;
+    bool should_shed() const;
+
+private:
+    const std::chrono::nanoseconds target_;
+    const std::chrono::nanoseconds interval_;
+
+    std::mutex mutex_; // Guards the current interval
+    std::chrono::steady_clock::time_point interval_end_;
+    std::chrono::nanoseconds min_delay_;
+
+    std::atomic<bool> overloaded_{false};
+    std::atomic<std::chrono::nanoseconds::rep> last_delay_{0};
+};
+
+} // namespace net
@@ -0,0 +1,138 @@
+#pragma once
+
+// standard
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace net {
+
+/**
+ * @brief What a server stream does when a write would go over its send queue limits.
+ */
+enum class OverflowPolicy {
+    block_producer, // Wait until the client has read enough messages (never waits on a completion queue thread)
+    drop_oldest, // Drop queued messages that haven't started sending yet to make room
+    drop_newest, // Drop the message being written
+    disconnect, // Cancel the call so a slow client can't hold on to server memory
+};
+
+/**
+ * @brief Limits on the messages a server stream holds before they are sent. A limit of 0 means unbounded.
+ */
+struct SendQueueOptions {
+    std::size_t max_queued_messages = 0u;
+    std::size_t max_queued_bytes = 0u;
+    OverflowPolicy overflow_policy = OverflowPolicy::drop_newest;
+};
+
+/**
+ * @brief Lets a server stream hand gRPC several queued messages before they are flushed to the network.
+ *
+ *     Messages written while more are waiting in the send queue carry a buffer hint so gRPC can coalesce
+ *     them. The batch is flushed once `max_messages` messages or `max_bytes` bytes have been written (or
+ *     the queue runs dry). A `max_messages` of 0 disables batching and a `max_bytes` of 0 means no limit.
+ *
+ *     Batching saves the flushes, not the writes. gRPC still takes one write at a time on a stream, so
+ *     each message still waits for the completion queue to hand the previous one back.
+ */
+struct WriteBatchOptions {
+    std::size_t max_messages = 0u;
+    std::size_t max_bytes = 0u;
+};
+
+/**
+ * @brief Per-RPC settings passed to `AsyncServer::register_rpc`.
+ */
+struct RpcOptions {
+    /**
+     * @brief The RPC's label in `AsyncServer::metrics`. RPCs left unnamed are called "rpc_<index>"
+     *        after the order they were registered in.
+     */
+    std::string name = {};
+
+    /**
+     * @brief Create each call's request (and unary response) on a protobuf arena owned by the pooled
+     *        connection instead of the heap. Handlers can get the arena with `response->GetArena()`
+     *        to build any other short lived messages on it. Unary methods marked raw ignore it since
+     *        their messages are byte buffers.
+     */
+    bool use_arena = false;
+
+    /**
+     * @brief Bounds the memory each stream of a server streaming RPC can use for unsent messages.
+     */
+    SendQueueOptions send_queue = {};
+
+    /**
+     * @brief Coalesces the writes of a server streaming RPC. When batching is enabled the last response
+     *        is sent together with the status if `finish` was called before it went out.
+     */
+    WriteBatchOptions write_batch = {};
+
+    /**
+     * @brief Run the connect callback on the server's handler threads instead of the completion queue
+     *        thread so a slow callback doesn't hold up every other call on that queue. The call starts
+     *        once the callback returns. Read and drained callbacks still run on the completion queue
+     *        thread. Needs an `AsyncServer` created with at least one handler thread. Callbacks waiting
+     *        for a handler thread run in order of their client's deadline (calls without one go last).
+     */
+    bool offload = false;
+
+    /**
+     * @brief The number of calls each completion queue keeps requested from gRPC before clients make
+     *        them. With more than one, a burst of new calls doesn't have to wait for the queue thread to
+     *        request the next call after each one is accepted. Must be at least 1.
+     */
+    std::size_t pending_requests = 1u;
+
+    /**
+     * @brief The most calls of this RPC that can be in progress at once, summed over every completion
+     *        queue. Calls over the limit fail with `RESOURCE_EXHAUSTED` without running any callback.
+     *        Unlimited if 0.
+     */
+    std::size_t max_in_flight = 0u;
+};
+
+/**
+ * @brief Server wide limits on accepting new calls, passed to the `AsyncServer` constructor.
+ *
+ *     Calls turned away fail with `RESOURCE_EXHAUSTED` before any callback runs, so an overloaded server
+ *     spends its time on the calls it has already accepted instead of slowing every call down. Calls
+ *     that were accepted are never interrupted.
+ */
+struct AdmissionOptions {
+    /**
+     * @brief New calls are refused while the server streams have more than this many bytes of responses
+     *        waiting to be sent. Unlimited if 0.
+     */
+    std::size_t max_buffered_stream_bytes = 0u;
+
+    /**
+     * @brief The time events are allowed to wait on a completion queue (and offloaded callbacks on the
+     *        handler threads) before new calls are shed (see `QueueDelayShedder`). Completion queue
+     *        delays are measured with a timer that fires ten times per interval, so the target should
+     *        be well above the timer's resolution (about a millisecond). Disabled if 0.
+     */
+    std::chrono::microseconds target_queue_delay{0};
+    std::chrono::milliseconds queue_delay_interval{100};
+};
+
+/**
+ * @brief Where the completion queue threads run, passed to the `AsyncServer` constructor.
+ *
+ *     Every queue's thread creates its own RPC calls (along with their connection pools and the tags
+ *     in them), which a pinned thread does once it's pinned. Memory is placed on the NUMA node of
+ *     the thread that first touches it, so a queue's connections then live on the node its thread
+ *     runs on instead of the node of the thread that registered the RPCs (see `numa_node_cpus`).
+ */
+struct PlacementOptions {
+    /**
+     * @brief The CPUs each completion queue's thread is pinned to. Queue `i` uses the set at `i` modulo
+     *        the number of sets, so a single set pins every queue to it. Queues aren't pinned if empty.
+     */
+    std::vector<std::vector<unsigned>> poller_cpus;
+};
+
+} // namespace net
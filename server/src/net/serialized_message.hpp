@@ -0,0 +1,115 @@
+#pragma once
+
+// third-party
+#include <grpcpp/impl/codegen/proto_utils.h>
+#include <grpcpp/support/byte_buffer.h>
+#include <grpcpp/support/slice.h>
+
+// standard
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace net {
+
+/**
+ * @brief A message serialized into the wire format gRPC sends.
+ *
+ *     The bytes live in reference counted slices so copies of a `SerializedMessage` (and the copies
+ *     gRPC makes when the message is written) share a single buffer. Serializing a response once and
+ *     writing it to many streams costs one encode no matter how many clients receive it.
+ *
+ * @tparam Message - The protobuf message type that was serialized
+ */
+template <typename Message>
+class SerializedMessage {
+public:
+    explicit SerializedMessage(const Message& message);
+
+    /**
+     * @brief Wraps bytes that already hold a serialized `Message` without copying them. The bytes must
+     *        stay valid and unchanged until every stream they are written to has finished.
+     */
+    static SerializedMessage from_static_bytes(const void* data, std::size_t size);
+
+    /**
+     * @brief Wraps a buffer that already holds a serialized `Message` (e.g. the request of a raw method).
+     *        The buffer's slices are shared, not copied.
+     */
+    static SerializedMessage from_buffer(const grpc::ByteBuffer& buffer);
+
+    /**
+     * @brief Parses the bytes back into a message.
+     * @throws std::runtime_error if they don't hold a valid `Message`
+     */
+    Message parse() const;
+
+    /**
+     * @brief Parses the bytes into `message` (e.g. a field of a bigger message) so nothing is copied
+     *        into place afterwards.
+     * @throws std::runtime_error if they don't hold a valid `Message`
+     */
+    void parse(Message* message) const;
+
+    const grpc::ByteBuffer& buffer() const& { return buffer_; }
+
+    // Lets a message that is only written once hand its buffer over instead of sharing it
+    grpc::ByteBuffer&& buffer() && { return std::move(buffer_); }
+    std::size_t bytes() const { return bytes_; }
+
+private:
+    SerializedMessage() = default;
+
+    grpc::ByteBuffer buffer_;
+    std::size_t bytes_ = 0u;
+};
+
+template <typename Message>
+SerializedMessage<Message>::SerializedMessage(const Message& message) {
+    bool own_buffer = false;
+    grpc::Status status = grpc::SerializationTraits<Message>::Serialize(message, &buffer_, &own_buffer);
+
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to serialize message: " + status.error_message());
+    }
+    bytes_ = buffer_.Length();
+}
+
+template <typename Message>
+SerializedMessage<Message> SerializedMessage<Message>::from_static_bytes(const void* data, std::size_t size) {
+    grpc::Slice slice(data, size, grpc::Slice::STATIC_SLICE);
+
+    SerializedMessage serialized;
+    serialized.buffer_ = grpc::ByteBuffer(&slice, 1u);
+    serialized.bytes_ = size;
+    return serialized;
+}
+
+template <typename Message>
+SerializedMessage<Message> SerializedMessage<Message>::from_buffer(const grpc::ByteBuffer& buffer) {
+    SerializedMessage serialized;
+    serialized.buffer_ = buffer;
+    serialized.bytes_ = buffer.Length();
+    return serialized;
+}
+
+template <typename Message>
+Message SerializedMessage<Message>::parse() const {
+    Message message;
+    parse(&message);
+    return message;
+}
+
+template <typename Message>
+void SerializedMessage<Message>::parse(Message* message) const {
+    // Deserializing consumes the buffer so it works on a copy that shares the slices
+    grpc::ByteBuffer buffer(buffer_);
+
+    grpc::Status status = grpc::SerializationTraits<Message>::Deserialize(&buffer, message);
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to parse message: " + status.error_message());
+    }
+}
+
+} // namespace net
@@ -1,12 +1,28 @@
 #pragma once
 
 // project
+#include "net/connection_pool.hpp"
 #include "net/connections.hpp"
+#include "net/metrics.hpp"
+#include "net/rpc_options.hpp"
+#include "net/tracer.hpp"
 #include "testing/testing.hpp"
 
 // third-party
 #include <grpcpp/completion_queue.h>
 
+// standard
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
 #ifdef DOCTEST_LIBRARY_INCLUDED
 #include <testing/test_service.h>
 #endif
@@ -29,6 +45,77 @@ using UnaryRpcFunction = RpcFunction<Service, Request, Response, grpc::ServerAsy
 template <typename Service, typename Request, typename Response>
 using ServerStreamRpcFunction = RpcFunction<Service, Request, Response, grpc::ServerAsyncWriter>;
 
+/**
+ * @brief The function signature for RPC calls whose requests are read from a stream
+ */
+template <typename Service, typename Stream>
+using StreamingRpcFunction
+    = void (Service::*)(grpc::ServerContext*, Stream*, grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+
+/**
+ * @brief The function signature for an async service's client-side-streaming RPC calls
+ */
+template <typename Service, typename Request, typename Response>
+using ClientStreamRpcFunction = StreamingRpcFunction<Service, grpc::ServerAsyncReader<Response, Request>>;
+
+/**
+ * @brief The function signature for an async service's bidirectional streaming RPC calls
+ */
+template <typename Service, typename Request, typename Response>
+using BidiStreamRpcFunction = StreamingRpcFunction<Service, grpc::ServerAsyncReaderWriter<Response, Request>>;
+
+/**
+ * @brief The function signature of a server-side-streaming RPC marked raw in the async service (`WithRawMethod_*`)
+ */
+template <typename Service>
+using RawServerStreamRpcFunction = ServerStreamRpcFunction<Service, grpc::ByteBuffer, grpc::ByteBuffer>;
+
+/**
+ * @brief The function signature of a bidirectional streaming RPC marked raw in the async service
+ */
+template <typename Service>
+using RawBidiStreamRpcFunction = BidiStreamRpcFunction<Service, grpc::ByteBuffer, grpc::ByteBuffer>;
+
+/**
+ * @brief A raw streaming RPC along with the message types from its proto definition, which the raw
+ *        function signature no longer carries. Made by `raw_stream`.
+ */
+template <typename Request, typename Response, typename RawRpcFunction>
+struct RawStreamRpc {
+    RawRpcFunction rpc_function;
+};
+
+/**
+ * @brief Wraps a server-side-streaming or bidirectional RPC marked raw for `AsyncServer::register_rpc`.
+ *
+ *     Streams queue their responses already serialized (so a `SerializedMessage` can be shared by many
+ *     streams) and gRPC only writes those bytes as they are to calls of raw methods. Streams registered
+ *     as usual work too, but parse each response back so gRPC can serialize it again. Marking the method
+ *     raw is opt-in and its handlers still get typed requests and streams:
+ *
+ *     ```cpp
+ *     using Service = mypkg::MyService::WithRawMethod_MyStream<mypkg::MyService::AsyncService>;
+ *
+ *     server.register_rpc(raw_stream<mypkg::MyRequest, mypkg::MyResponse>(&Service::RequestMyStream),
+ *                         [](const mypkg::MyRequest& request, ServerToClientStream<mypkg::MyResponse>* stream) {
+ *                             ...
+ *                         });
+ *     ```
+ *
+ *     Requests that don't parse as a `Request` finish the call with `INVALID_ARGUMENT`.
+ */
+template <typename Request, typename Response, typename Service>
+RawStreamRpc<Request, Response, RawServerStreamRpcFunction<Service>>
+raw_stream(RawServerStreamRpcFunction<Service> rpc_function) {
+    return {rpc_function};
+}
+
+template <typename Request, typename Response, typename Service>
+RawStreamRpc<Request, Response, RawBidiStreamRpcFunction<Service>>
+raw_stream(RawBidiStreamRpcFunction<Service> rpc_function) {
+    return {rpc_function};
+}
+
 namespace detail {
 
 struct EmptyDisconnect {
@@ -36,70 +123,361 @@ struct EmptyDisconnect {
 };
 
 template <typename Service>
-struct RpcCallHandle {
-    virtual ~RpcCallHandle() = 0;
-    virtual void queue_next_client_connection(Service* service, grpc::ServerCompletionQueue* queue, Tagger* tagger) = 0;
-    virtual std::unique_ptr<Connection> extract_active_connection() = 0;
-    virtual void disconnect(void* connection) = 0;
+struct RpcCallHandle : ConnectionOwner {
+    /**
+     * @brief One of the calls requested from gRPC ahead of a client making it. Its tag comes back when a
+     *        client calls the RPC (see `RpcOptions::pending_requests`).
+     */
+    struct RequestSlot {
+        RpcCallHandle* rpc_call;
+        std::size_t index;
+        TagCount tag_count{0u};
+        Tag requested_tag{TagLabel::rpc_call_requested_by_client, this, &tag_count};
+
+        RequestSlot(RpcCallHandle* call, std::size_t slot_index) : rpc_call(call), index(slot_index) {}
+    };
+
+    std::vector<std::unique_ptr<RequestSlot>> request_slots;
+
+    // Shared by the RPC's copies on every completion queue. Set by `AsyncServer::register_rpc`.
+    std::shared_ptr<std::atomic<std::size_t>> in_flight = std::make_shared<std::atomic<std::size_t>>(0u);
+    std::atomic<std::size_t>* buffered_stream_bytes = nullptr;
+
+    explicit RpcCallHandle(std::size_t num_request_slots) {
+        for (auto i = 0u; i < num_request_slots; ++i) {
+            request_slots.emplace_back(std::make_unique<RequestSlot>(this, i));
+        }
+    }
+
+    ~RpcCallHandle() override = 0;
+
+    /**
+     * @brief Requests a call from gRPC for every slot.
+     */
+    void queue_client_connections(Service* service, grpc::ServerCompletionQueue* queue) {
+        for (auto& slot : request_slots) {
+            queue_next_client_connection(service, queue, slot.get());
+        }
+    }
+
+    bool defer_response(const std::shared_ptr<DeferredCall>& call) override {
+        std::lock_guard<std::mutex> lock(deferred_mutex_);
+        if (deferred_closed_) {
+            return false;
+        }
+        deferred_calls_.emplace(call.get(), call);
+        return true;
+    }
+
+    void deferred_response_finished(DeferredCall* call) override {
+        std::lock_guard<std::mutex> lock(deferred_mutex_);
+        if (deferred_calls_.erase(call) != 0u && deferred_calls_.empty()) {
+            deferred_finished_.notify_all();
+        }
+    }
+
+    /**
+     * @brief Counts a call that was just accepted as in flight unless `RpcOptions::max_in_flight` calls
+     *        already are. The call stops counting once it is disconnected.
+     */
+    bool reserve_in_flight(Connection* connection) {
+        std::size_t limit = max_in_flight();
+        if (limit == 0u) {
+            return true;
+        }
+        if (in_flight->fetch_add(1u, std::memory_order_relaxed) < limit) {
+            connection->holds_in_flight = true;
+            return true;
+        }
+        in_flight->fetch_sub(1u, std::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * @brief Finishes the calls of every `UnaryResponder` handed out so far with `UNAVAILABLE` unless they
+     *        already have been, and waits until gRPC has them all. Calls deferred after this are finished
+     *        right away the same way.
+     */
+    void close_deferred_responses() {
+        std::vector<std::weak_ptr<DeferredCall>> outstanding;
+        {
+            std::lock_guard<std::mutex> lock(deferred_mutex_);
+            deferred_closed_ = true;
+            for (auto& call : deferred_calls_) {
+                outstanding.emplace_back(call.second);
+            }
+        }
+
+        // Not under the lock since finishing a call reports back through `deferred_response_finished`.
+        // Calls whose last responder is being destroyed can't be locked but finish on their own.
+        for (auto& call : outstanding) {
+            if (auto deferred_call = call.lock()) {
+                deferred_call->cancel(grpc::Status(grpc::StatusCode::UNAVAILABLE, "The server is shutting down"));
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(deferred_mutex_);
+        deferred_finished_.wait(lock, [this] { return deferred_calls_.empty(); });
+    }
+
+    /**
+     * @brief Waits until every connection that got a call has been recycled, or until `deadline`.
+     *        Can be called from any thread.
+     * @return false if some were still active at `deadline`
+     */
+    bool wait_until_inactive(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(inactive_mutex_);
+        return inactive_.wait_until(lock, deadline, [this] { return active_.load(std::memory_order_acquire) == 0u; });
+    }
+
+    virtual void
+    queue_next_client_connection(Service* service, grpc::ServerCompletionQueue* queue, RequestSlot* slot) = 0;
+
+    /**
+     * @brief Hands over the connection for the client that was just accepted on `slot`. The connection
+     *        is returned to this handle through `recycle` once no more of its tags are on the queue.
+     */
+    virtual Connection* extract_active_connection(RequestSlot* slot) = 0;
+
+    /**
+     * @brief Runs the connect callback for a connection returned by `extract_active_connection`.
+     */
+    virtual void connect(Connection* connection) = 0;
+
+    /**
+     * @brief Whether the connect callback should be run on a handler thread (see `RpcOptions::offload`).
+     */
+    virtual bool offload() const = 0;
+    virtual std::size_t max_in_flight() const = 0;
+
+    /**
+     * @brief Cancels every active connection. Like everything that walks the connections, only called
+     *        on the completion queue thread.
+     */
+    virtual void cancel_active_connections() = 0;
+
+    /**
+     * @brief Tells every active connection the server is draining (see `Connection::drain`). Only called
+     *        on the completion queue thread.
+     */
+    virtual void drain_active_connections(const grpc::Status& status) = 0;
+
+    /**
+     * @brief Can be called from any thread.
+     */
+    virtual ConnectionPoolStats connection_pool_stats() const = 0;
+
+    /**
+     * @brief Adds this handle's counts and send queue gauges to `metrics`. Can be called from any thread.
+     */
+    virtual void add_metrics_to(RpcMetrics* metrics) = 0;
+
+protected:
+    void connection_activated() { active_.fetch_add(1u, std::memory_order_relaxed); }
+
+    void connection_deactivated() {
+        // Only the last one takes the lock. Taking it before notifying means a waiter that saw a connection
+        // still active is already waiting by then.
+        if (active_.fetch_sub(1u, std::memory_order_release) == 1u) {
+            std::lock_guard<std::mutex> lock(inactive_mutex_);
+            inactive_.notify_all();
+        }
+    }
+
+private:
+    std::atomic<std::size_t> active_{0u}; // Accepted connections that haven't been recycled
+    std::mutex inactive_mutex_;
+    std::condition_variable inactive_;
+
+    std::mutex deferred_mutex_;
+    std::condition_variable deferred_finished_;
+    std::unordered_map<DeferredCall*, std::weak_ptr<DeferredCall>> deferred_calls_;
+    bool deferred_closed_ = false;
 };
 
 template <typename Service>
 inline RpcCallHandle<Service>::~RpcCallHandle() = default;
 
+/**
+ * @brief Asks gRPC for the next call of a unary or server streaming RPC. The request arrives with the call.
+ */
+template <typename Service, typename BaseService, typename Request, typename Writer, typename RpcConnection>
+void request_rpc(Service* service,
+                 void (BaseService::*rpc_function)(
+                     grpc::ServerContext*, Request*, Writer*, grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*),
+                 RpcConnection* connection,
+                 grpc::ServerCompletionQueue* queue,
+                 void* tag) {
+    (service->*rpc_function)(&connection->context, connection->requested(), connection->writer(), queue, queue, tag);
+}
+
+/**
+ * @brief Asks gRPC for the next call of a client or bidirectional streaming RPC. The requests are read
+ *        from the stream once the call has started.
+ */
+template <typename Service, typename BaseService, typename Stream, typename RpcConnection>
+void request_rpc(Service* service,
+                 StreamingRpcFunction<BaseService, Stream> rpc_function,
+                 RpcConnection* connection,
+                 grpc::ServerCompletionQueue* queue,
+                 void* tag) {
+    (service->*rpc_function)(&connection->context, connection->writer(), queue, queue, tag);
+}
+
 /**
  * @brief
  * @tparam Service
- * @tparam BaseService
- * @tparam Request
- * @tparam Response
- * @tparam Writer
+ * @tparam RpcFunc - The service's `Request*` function for the RPC
  * @tparam RpcConnection
  * @tparam ConnectCallback
  * @tparam DisconnectCallback
  */
-template <typename Service,
-          typename BaseService,
-          typename Request,
-          typename Response,
-          template <typename> class Writer,
-          typename RpcConnection,
-          typename ConnectCallback,
-          typename DisconnectCallback>
+template <typename Service, typename RpcFunc, typename RpcConnection, typename ConnectCallback, typename DisconnectCallback>
 class RpcCall : public RpcCallHandle<Service> {
 public:
-    using RpcFunc = RpcFunction<BaseService, Request, Response, Writer>;
+    RpcCall(RpcFunc rpc_function,
+            ConnectCallback&& connect_callback,
+            DisconnectCallback&& disconnect_callback,
+            const RpcOptions& options)
+        : RpcCallHandle<Service>(options.pending_requests),
+          rpc_function_(rpc_function),
+          connect_callback_(connect_callback),
+          disconnect_callback_(disconnect_callback),
+          options_(options),
+          waiting_(options.pending_requests, nullptr) {}
+
+    void queue_next_client_connection(Service* service,
+                                      grpc::ServerCompletionQueue* queue,
+                                      typename RpcCallHandle<Service>::RequestSlot* slot) override {
+        RpcConnection* connection = pool_.acquire(options_);
+        connection->owner = this;
+        connection->buffered_stream_bytes = this->buffered_stream_bytes;
+        connection->counters = &counters_;
+
+        connection->context.AsyncNotifyWhenDone(Tagger::make_tag(&connection->finished_tag));
+
+        waiting_[slot->index] = connection;
+        request_rpc(service, rpc_function_, connection, queue, Tagger::make_tag(&slot->requested_tag));
+    }
+
+    Connection* extract_active_connection(typename RpcCallHandle<Service>::RequestSlot* slot) override {
+        RpcConnection* connection = waiting_[slot->index];
+        connection->started = std::chrono::steady_clock::now();
+        connection->deadline = connection->context.deadline();
+        counters_.call_started();
+        this->connection_activated();
+
+        waiting_[slot->index] = nullptr;
+        return connection;
+    }
+
+    void connect(Connection* connection) override {
+        HELLO_TRACE_SPAN("connect_callback", "callback");
+        static_cast<RpcConnection*>(connection)->connect(connect_callback_);
+    }
+
+    bool offload() const override { return options_.offload; }
+
+    std::size_t max_in_flight() const override { return options_.max_in_flight; }
+
+    void disconnect(Connection* connection) override {
+        // Connections still waiting for a client when the server shuts down were never counted
+        if (connection->started != std::chrono::steady_clock::time_point{}) {
+            bool cancelled = static_cast<RpcConnection*>(connection)->context.IsCancelled();
+            counters_.call_finished(cancelled ? grpc::StatusCode::CANCELLED : connection->finish_code,
+                                    std::chrono::steady_clock::now() - connection->started);
+        }
+
+        if (connection->holds_in_flight) {
+            this->in_flight->fetch_sub(1u, std::memory_order_relaxed);
+        }
 
-    RpcCall(RpcFunc rpc_function, ConnectCallback&& connect_callback, DisconnectCallback&& disconnect_callback)
-        : rpc_function_(rpc_function), connect_callback_(connect_callback), disconnect_callback_(disconnect_callback) {}
+        // Refused calls never reached the connect callback so they don't get a disconnect either
+        if (connection->rejected) {
+            return;
+        }
+        HELLO_TRACE_SPAN("disconnect_callback", "callback");
+        disconnect_callback_(connection);
+    }
+
+    void recycle(Connection* connection) override {
+        bool started = connection->started != std::chrono::steady_clock::time_point{};
 
-    void queue_next_client_connection(Service* service, grpc::ServerCompletionQueue* queue, Tagger* tagger) override {
-        connection_ = std::make_unique<RpcConnection>(tagger);
+        connection->release();
+        pool_.release(static_cast<RpcConnection*>(connection));
 
-        connection_->context.AsyncNotifyWhenDone(tagger->make_tag(TagLabel::rpc_finished, connection_.get()));
+        if (started) {
+            this->connection_deactivated();
+        }
+    }
 
-        (service->*rpc_function_)(&connection_->context,
-                                  &request_,
-                                  &connection_->responder,
-                                  queue,
-                                  queue,
-                                  tagger->make_tag(TagLabel::rpc_call_requested_by_client, this));
+    void cancel_active_connections() override {
+        pool_.for_each_in_use([this](RpcConnection* connection) {
+            // Connections waiting for a client haven't started a call yet so there is nothing to cancel
+            if (std::find(waiting_.begin(), waiting_.end(), connection) == waiting_.end()) {
+                connection->cancel();
+            }
+        });
     }
 
-    std::unique_ptr<Connection> extract_active_connection() override {
-        connection_->status = connect_callback_(request_, &connection_->response);
-        return std::move(connection_);
+    void drain_active_connections(const grpc::Status& status) override {
+        pool_.for_each_in_use([this, &status](RpcConnection* connection) {
+            if (std::find(waiting_.begin(), waiting_.end(), connection) == waiting_.end()) {
+                connection->drain(status);
+            }
+        });
     }
 
-    void disconnect(void* connection) override { disconnect_callback_(connection); }
+    ConnectionPoolStats connection_pool_stats() const override { return pool_.stats(); }
+
+    void add_metrics_to(RpcMetrics* metrics) override {
+        metrics->name = options_.name;
+        counters_.add_to(metrics);
+    }
 
 private:
     RpcFunc rpc_function_;
-    Request request_;
     ConnectCallback connect_callback_;
     DisconnectCallback disconnect_callback_;
-    std::unique_ptr<RpcConnection> connection_;
+    RpcOptions options_;
+    ConnectionPool<RpcConnection> pool_;
+    std::vector<RpcConnection*> waiting_; // The connection requested by each slot
+    RpcCounters counters_;
 };
 
+/**
+ * @brief Creates an `RpcCall` whose connections keep their messages on a `CallArena` when
+ *        `options.use_arena` is set and on the heap otherwise.
+ *
+ * @tparam Service
+ * @tparam ArenaConnection - The connection type to use with an arena
+ * @tparam HeapConnection - The connection type to use without one
+ */
+template <typename Service,
+          typename ArenaConnection,
+          typename HeapConnection,
+          typename RpcFunc,
+          typename ConnectCallback,
+          typename DisconnectCallback>
+std::unique_ptr<detail::RpcCallHandle<Service>> make_rpc_call(RpcFunc rpc_function,
+                                                              ConnectCallback&& connect_callback,
+                                                              DisconnectCallback&& disconnect_callback,
+                                                              const RpcOptions& options) {
+    using ArenaRpcCall = detail::RpcCall<Service, RpcFunc, ArenaConnection, ConnectCallback, DisconnectCallback>;
+    using HeapRpcCall = detail::RpcCall<Service, RpcFunc, HeapConnection, ConnectCallback, DisconnectCallback>;
+
+    if (options.use_arena) {
+        return std::make_unique<ArenaRpcCall>(rpc_function,
+                                              std::forward<ConnectCallback>(connect_callback),
+                                              std::forward<DisconnectCallback>(disconnect_callback),
+                                              options);
+    }
+    return std::make_unique<HeapRpcCall>(rpc_function,
+                                         std::forward<ConnectCallback>(connect_callback),
+                                         std::forward<DisconnectCallback>(disconnect_callback),
+                                         options);
+}
+
 /**
  * @brief
  * @tparam Service
@@ -123,22 +501,56 @@ template <typename Service,
 std::unique_ptr<detail::RpcCallHandle<Service>>
 make_rpc_call_handle(UnaryRpcFunction<BaseService, Request, Response> unary_rpc_function,
                      ConnectCallback&& connect_callback,
-                     DisconnectCallback&& disconnect_callback) {
+                     DisconnectCallback&& disconnect_callback,
+                     const RpcOptions& options) {
 
     static_assert(std::is_base_of<BaseService, Service>::value, "BaseService must be a base class of Service");
 
-    using UnaryRpc = detail::RpcCall<Service,
-                                     BaseService,
-                                     Request,
-                                     Response,
-                                     grpc::ServerAsyncResponseWriter,
-                                     UnaryRpcConnection<Response>,
-                                     ConnectCallback,
-                                     DisconnectCallback>;
-
-    return std::make_unique<UnaryRpc>(unary_rpc_function,
-                                      std::forward<ConnectCallback>(connect_callback),
-                                      std::forward<DisconnectCallback>(disconnect_callback));
+    // The request and response of a raw method are byte buffers, which can't go on an arena, so their
+    // connections don't carry one they'd never use
+    using Arena = std::conditional_t<std::is_same<Request, grpc::ByteBuffer>::value, NoCallArena, CallArena>;
+
+    return make_rpc_call<Service,
+                         ConnectionWithRequest<Request, UnaryRpcConnection<Response>, Arena>,
+                         ConnectionWithRequest<Request, UnaryRpcConnection<Response>, NoCallArena>>(
+        unary_rpc_function,
+        std::forward<ConnectCallback>(connect_callback),
+        std::forward<DisconnectCallback>(disconnect_callback),
+        options);
+}
+
+/**
+ * @brief Wraps a server stream's callbacks for either kind of connection (raw or typed).
+ */
+template <typename Service,
+          typename ArenaConnection,
+          typename HeapConnection,
+          typename Request,
+          typename Response,
+          typename RpcFunc,
+          typename ConnectCallback,
+          typename DisconnectCallback>
+std::unique_ptr<detail::RpcCallHandle<Service>> make_server_stream_rpc_call(RpcFunc rpc_function,
+                                                                            ConnectCallback&& connect_callback,
+                                                                            DisconnectCallback&& disconnect_callback,
+                                                                            const RpcOptions& options) {
+    auto connect_callback_wrapper
+        = [connect_callback](const Request& request,
+                             ServerToClientStream<Response>* stream) -> std::unique_ptr<grpc::Status> {
+        connect_callback(request, stream);
+        return stream->status();
+    };
+
+    auto disconnect_callback_wrapper = [disconnect_callback{disconnect_callback}](Connection* connection) {
+        auto server_stream_connection = static_cast<ServerStreamRpcConnection<Response>*>(connection);
+        disconnect_callback(&server_stream_connection->response);
+    };
+
+    return make_rpc_call<Service, ArenaConnection, HeapConnection>(
+        rpc_function,
+        std::move(connect_callback_wrapper),
+        std::move(disconnect_callback_wrapper),
+        options);
 }
 
 /**
@@ -149,7 +561,7 @@ make_rpc_call_handle(UnaryRpcFunction<BaseService, Request, Response> unary_rpc_
  * @tparam Response
  * @tparam ConnectCallback
  * @tparam DisconnectCallback
- * @param server_stream_rpc_function
+ * @param server_stream_rpc - The raw RPC function and its message types
  * @param connect_callback
  * @param disconnect_callback
  * @return
@@ -161,36 +573,183 @@ template <typename Service,
           typename ConnectCallback,
           typename DisconnectCallback>
 std::unique_ptr<detail::RpcCallHandle<Service>>
+make_rpc_call_handle(RawStreamRpc<Request, Response, RawServerStreamRpcFunction<BaseService>> server_stream_rpc,
+                     ConnectCallback&& connect_callback,
+                     DisconnectCallback&& disconnect_callback,
+                     const RpcOptions& options) {
+
+    static_assert(std::is_base_of<BaseService, Service>::value, "BaseService must be a base class of Service");
+
+    using StreamConnection = ServerWriterRpcConnection<Response>;
+
+    return make_server_stream_rpc_call<Service,
+                                       ConnectionWithRawRequest<Request, StreamConnection, CallArena>,
+                                       ConnectionWithRawRequest<Request, StreamConnection, NoCallArena>,
+                                       Request,
+                                       Response>(server_stream_rpc.rpc_function,
+                                                 std::forward<ConnectCallback>(connect_callback),
+                                                 std::forward<DisconnectCallback>(disconnect_callback),
+                                                 options);
+}
+
+/**
+ * @brief A server stream whose method isn't marked raw. Each response is parsed back from the send queue
+ *        before gRPC serializes it (see `StreamWriteMessage`), so `raw_stream` is cheaper for busy streams.
+ */
+template <typename Service,
+          typename BaseService,
+          typename Request,
+          typename Response,
+          typename ConnectCallback,
+          typename DisconnectCallback>
+std::unique_ptr<detail::RpcCallHandle<Service>>
 make_rpc_call_handle(ServerStreamRpcFunction<BaseService, Request, Response> server_stream_rpc_function,
                      ConnectCallback&& connect_callback,
-                     DisconnectCallback&& disconnect_callback) {
+                     DisconnectCallback&& disconnect_callback,
+                     const RpcOptions& options) {
 
     static_assert(std::is_base_of<BaseService, Service>::value, "BaseService must be a base class of Service");
+    static_assert(!std::is_same<Request, grpc::ByteBuffer>::value,
+                  "Streams marked raw in the async service are registered with `net::raw_stream`");
+
+    using StreamConnection = ServerWriterRpcConnection<Response, false>;
+
+    return make_server_stream_rpc_call<Service,
+                                       ConnectionWithRequest<Request, StreamConnection, CallArena>,
+                                       ConnectionWithRequest<Request, StreamConnection, NoCallArena>,
+                                       Request,
+                                       Response>(server_stream_rpc_function,
+                                                 std::forward<ConnectCallback>(connect_callback),
+                                                 std::forward<DisconnectCallback>(disconnect_callback),
+                                                 options);
+}
 
-    auto connect_callback_wrapper
-        = [connect_callback](const Request& request,
-                             ServerToClientStream<Response>* stream) -> std::unique_ptr<grpc::Status> {
-        connect_callback(request, stream);
-        return stream->status();
+/**
+ * @brief
+ * @tparam Service
+ * @tparam BaseService
+ * @tparam Request
+ * @tparam Response
+ * @tparam ConnectCallback - Called with a `ClientToServerStream<Request, Response>*` once the call starts
+ * @tparam DisconnectCallback
+ * @param client_stream_rpc_function
+ * @param connect_callback
+ * @param disconnect_callback
+ * @return
+ */
+template <typename Service,
+          typename BaseService,
+          typename Request,
+          typename Response,
+          typename ConnectCallback,
+          typename DisconnectCallback>
+std::unique_ptr<detail::RpcCallHandle<Service>>
+make_rpc_call_handle(ClientStreamRpcFunction<BaseService, Request, Response> client_stream_rpc_function,
+                     ConnectCallback&& connect_callback,
+                     DisconnectCallback&& disconnect_callback,
+                     const RpcOptions& options) {
+
+    static_assert(std::is_base_of<BaseService, Service>::value, "BaseService must be a base class of Service");
+
+    auto disconnect_callback_wrapper = [disconnect_callback{disconnect_callback}](Connection* connection) {
+        auto client_stream_connection = static_cast<ClientStreamRpcConnection<Request, Response>*>(connection);
+        disconnect_callback(&client_stream_connection->stream);
     };
 
-    auto disconnect_callback_wrapper = [disconnect_callback{disconnect_callback}](void* connection) {
-        auto server_stream_connection = static_cast<ServerStreamRpcConnection<Response>*>(connection);
-        disconnect_callback(&server_stream_connection->response);
+    return make_rpc_call<Service,
+                         ConnectionWithArena<ClientStreamRpcConnection<Request, Response>, CallArena>,
+                         ConnectionWithArena<ClientStreamRpcConnection<Request, Response>, NoCallArena>>(
+        client_stream_rpc_function,
+        std::forward<ConnectCallback>(connect_callback),
+        std::move(disconnect_callback_wrapper),
+        options);
+}
+
+/**
+ * @brief Wraps a bidirectional stream's disconnect callback for either kind of connection (raw or typed).
+ */
+template <typename Service,
+          typename BidiConnection,
+          typename RpcFunc,
+          typename ConnectCallback,
+          typename DisconnectCallback>
+std::unique_ptr<detail::RpcCallHandle<Service>> make_bidi_stream_rpc_call(RpcFunc rpc_function,
+                                                                          ConnectCallback&& connect_callback,
+                                                                          DisconnectCallback&& disconnect_callback,
+                                                                          const RpcOptions& options) {
+    auto disconnect_callback_wrapper = [disconnect_callback{disconnect_callback}](Connection* connection) {
+        auto bidi_stream_connection = static_cast<BidiConnection*>(connection);
+        disconnect_callback(&bidi_stream_connection->stream);
     };
 
-    using ServerStreamRpc = detail::RpcCall<Service,
-                                            BaseService,
-                                            Request,
-                                            Response,
-                                            grpc::ServerAsyncWriter,
-                                            ServerStreamRpcConnection<Response>,
-                                            decltype(connect_callback_wrapper),
-                                            decltype(disconnect_callback_wrapper)>;
-
-    return std::make_unique<ServerStreamRpc>(server_stream_rpc_function,
-                                             std::move(connect_callback_wrapper),
-                                             std::move(disconnect_callback_wrapper));
+    return make_rpc_call<Service,
+                         ConnectionWithArena<BidiConnection, CallArena>,
+                         ConnectionWithArena<BidiConnection, NoCallArena>>(
+        rpc_function,
+        std::forward<ConnectCallback>(connect_callback),
+        std::move(disconnect_callback_wrapper),
+        options);
+}
+
+/**
+ * @brief
+ * @tparam Service
+ * @tparam BaseService
+ * @tparam Request
+ * @tparam Response
+ * @tparam ConnectCallback - Called with a `BidiStream<Request, Response>*` once the call starts
+ * @tparam DisconnectCallback
+ * @param bidi_stream_rpc - The raw RPC function and its message types
+ * @param connect_callback
+ * @param disconnect_callback
+ * @return
+ */
+template <typename Service,
+          typename BaseService,
+          typename Request,
+          typename Response,
+          typename ConnectCallback,
+          typename DisconnectCallback>
+std::unique_ptr<detail::RpcCallHandle<Service>>
+make_rpc_call_handle(RawStreamRpc<Request, Response, RawBidiStreamRpcFunction<BaseService>> bidi_stream_rpc,
+                     ConnectCallback&& connect_callback,
+                     DisconnectCallback&& disconnect_callback,
+                     const RpcOptions& options) {
+
+    static_assert(std::is_base_of<BaseService, Service>::value, "BaseService must be a base class of Service");
+
+    return make_bidi_stream_rpc_call<Service, BidiStreamRpcConnection<Request, Response>>(
+        bidi_stream_rpc.rpc_function,
+        std::forward<ConnectCallback>(connect_callback),
+        std::forward<DisconnectCallback>(disconnect_callback),
+        options);
+}
+
+/**
+ * @brief A bidirectional stream whose method isn't marked raw. Responses cost what they do on a typed
+ *        server stream (see above).
+ */
+template <typename Service,
+          typename BaseService,
+          typename Request,
+          typename Response,
+          typename ConnectCallback,
+          typename DisconnectCallback>
+std::unique_ptr<detail::RpcCallHandle<Service>>
+make_rpc_call_handle(BidiStreamRpcFunction<BaseService, Request, Response> bidi_stream_rpc_function,
+                     ConnectCallback&& connect_callback,
+                     DisconnectCallback&& disconnect_callback,
+                     const RpcOptions& options) {
+
+    static_assert(std::is_base_of<BaseService, Service>::value, "BaseService must be a base class of Service");
+    static_assert(!std::is_same<Request, grpc::ByteBuffer>::value,
+                  "Streams marked raw in the async service are registered with `net::raw_stream`");
+
+    return make_bidi_stream_rpc_call<Service, BidiStreamRpcConnection<Request, Response, false>>(
+        bidi_stream_rpc_function,
+        std::forward<ConnectCallback>(connect_callback),
+        std::forward<DisconnectCallback>(disconnect_callback),
+        options);
 }
 
 } // namespace detail
@@ -205,19 +764,22 @@ detail::make_rpc_call_handle<testing::proto::Echo::AsyncService,
                              detail::EmptyDisconnect>(
     UnaryRpcFunction<testing::proto::Echo::AsyncService, testing::proto::EchoRequest, testing::proto::EchoResponse>,
     testing::TestService&&,
-    EmptyDisconnect&&);
+    EmptyDisconnect&&,
+    const RpcOptions&);
 
-template std::unique_ptr<detail::RpcCallHandle<testing::proto::Echo::AsyncService>>
-detail::make_rpc_call_handle<testing::proto::Echo::AsyncService,
-                             testing::proto::Echo::AsyncService,
+template std::unique_ptr<detail::RpcCallHandle<testing::EchoService>>
+detail::make_rpc_call_handle<testing::EchoService,
+                             testing::EchoService,
                              testing::proto::EchoRequest,
                              testing::proto::EchoResponse,
                              testing::TestService,
-                             detail::EmptyDisconnect>(ServerStreamRpcFunction<testing::proto::Echo::AsyncService,
-                                                                              testing::proto::EchoRequest,
-                                                                              testing::proto::EchoResponse>,
-                                                      testing::TestService&&,
-                                                      detail::EmptyDisconnect&&);
+                             detail::EmptyDisconnect>(
+    RawStreamRpc<testing::proto::EchoRequest,
+                 testing::proto::EchoResponse,
+                 RawServerStreamRpcFunction<testing::EchoService>>,
+    testing::TestService&&,
+    detail::EmptyDisconnect&&,
+    const RpcOptions&);
 #endif
 
 } // namespace net
@@ -1,5 +1,41 @@
 #pragma once
 
 // project
+#include "net/connections.hpp"
+#include "net/serialized_message.hpp"
 
-namespace net {} // namespace net
+// standard
+#include <cstddef>
+
+namespace net {
+
+/**
+ * @brief Writes a response that has already been serialized to every stream in `streams`.
+ */
+template <typename Response, typename Streams>
+std::size_t broadcast(const SerializedMessage<Response>& response, const Streams& streams) {
+    std::size_t written = 0u;
+    for (ServerToClientStream<Response>* stream : streams) {
+        if (stream->write(response)) {
+            ++written;
+        }
+    }
+    return written;
+}
+
+/**
+ * @brief Serializes `response` once and writes the shared bytes to every stream in `streams`.
+ *
+ *     Each stream's `OverflowPolicy` still applies, so slow clients may drop the response or be
+ *     disconnected without affecting the rest.
+ *
+ * @tparam Response
+ * @tparam Streams - A range of `ServerToClientStream<Response>*`
+ * @return the number of streams that accepted the response
+ */
+template <typename Response, typename Streams>
+std::size_t broadcast(const Response& response, const Streams& streams) {
+    return broadcast(SerializedMessage<Response>(response), streams);
+}
+
+} // namespace net
@@ -6,60 +6,75 @@
 namespace net {
 namespace detail {
 
-void* Tagger::make_tag(TagLabel label, void* data) {
-    auto tag = std::make_unique<Tag>(Tag{label, data});
-    void* tag_id = tag.get();
-    tags_.emplace(tag_id, std::move(tag));
-    counts_[data] += 1;
-    return tag_id;
+void* Tagger::make_tag(Tag* tag) {
+    tag->count->fetch_add(1u, std::memory_order_relaxed);
+    return tag;
 }
 
 std::pair<Tag, unsigned> Tagger::get_tag(void* tag_id) {
-    Tag tag = *tags_.at(tag_id);
-    tags_.erase(tag_id);
-
-    counts_.at(tag.data) -= 1;
-    unsigned count = counts_.at(tag.data);
-
-    if (count == 0) {
-        counts_.erase(tag.data);
-    }
-
+    Tag tag = *static_cast<Tag*>(tag_id);
+    unsigned count = tag.count->fetch_sub(1u, std::memory_order_acq_rel) - 1u;
     return std::make_pair(tag, count);
 }
 
-unsigned Tagger::count(void* data) {
-    if (counts_.find(data) == counts_.end()) {
-        return 0u;
+unsigned Tagger::count(const Tag& tag) {
+    return tag.count->load(std::memory_order_acquire);
+}
+
+const char* label_name(TagLabel label) {
+    switch (label) {
+    case TagLabel::rpc_call_requested_by_client:
+        return "rpc_call_requested_by_client";
+    case TagLabel::processing:
+        return "processing";
+    case TagLabel::reading:
+        return "reading";
+    case TagLabel::connected:
+        return "connected";
+    case TagLabel::rpc_finished:
+        return "rpc_finished";
+    case TagLabel::queue_delay_probe:
+        return "queue_delay_probe";
+    case TagLabel::poller_tasks:
+        return "poller_tasks";
     }
-    return counts_.at(data);
+    return "unknown";
 }
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
-struct TestTag {
+struct TestTagged {
     int unused = 1;
-    void* data = &unused;
-    void* tag = nullptr;
+    TagCount count{0u};
+    Tag finished_tag{TagLabel::rpc_finished, &unused, &count};
+    Tag processing_tag{TagLabel::processing, &unused, &count};
 };
 
 TEST_CASE("[net] test Tagger") {
-    Tagger tagger;
+    TestTagged data1{};
+    TestTagged data2{};
 
-    TestTag data1{};
-    TestTag data2 = data1;
-    TestTag data3{};
-    REQUIRE(data2.data == data1.data);
+    void* tag1 = nullptr;
+    void* tag2 = nullptr;
+    void* tag3 = nullptr;
 
     // counts increment correctly
     {
-        data1.tag = tagger.make_tag(TagLabel::rpc_finished, data1.data);
-        CHECK(tagger.count(data1.data) == 1);
+        tag1 = Tagger::make_tag(&data1.finished_tag);
+        CHECK(Tagger::count(data1.finished_tag) == 1);
+
+        tag2 = Tagger::make_tag(&data1.processing_tag);
+        CHECK(Tagger::count(data1.finished_tag) == 2);
+        CHECK(Tagger::count(data1.processing_tag) == 2);
 
-        data2.tag = tagger.make_tag(TagLabel::processing, data2.data);
-        CHECK(tagger.count(data2.data) == 2);
+        tag3 = Tagger::make_tag(&data2.processing_tag);
+        CHECK(Tagger::count(data2.processing_tag) == 1);
+    }
 
-        data3.tag = tagger.make_tag(TagLabel::rpc_call_requested_by_client, data3.data);
-        CHECK(tagger.count(data3.data) == 1);
+    // tags are the objects they were made from
+    {
+        CHECK(tag1 == &data1.finished_tag);
+        CHECK(tag2 == &data1.processing_tag);
+        CHECK(tag3 == &data2.processing_tag);
     }
 
     // data is correct
@@ -67,26 +82,28 @@ TEST_CASE("[net] test Tagger") {
         Tag tag{};
         unsigned count;
 
-        std::tie(tag, count) = tagger.get_tag(data3.tag);
-        CHECK(tag.label == TagLabel::rpc_call_requested_by_client);
-        CHECK(tag.data == data3.data);
+        std::tie(tag, count) = Tagger::get_tag(tag3);
+        CHECK(tag.label == TagLabel::processing);
+        CHECK(tag.data == &data2.unused);
         CHECK(count == 0);
 
-        std::tie(tag, count) = tagger.get_tag(data1.tag);
+        std::tie(tag, count) = Tagger::get_tag(tag1);
         CHECK(tag.label == TagLabel::rpc_finished);
-        CHECK(tag.data == data1.data);
+        CHECK(tag.data == &data1.unused);
         CHECK(count == 1);
 
-        std::tie(tag, count) = tagger.get_tag(data2.tag);
+        // the same tag can be reused once it has been taken off the queue
+        tag1 = Tagger::make_tag(&data1.finished_tag);
+        CHECK(Tagger::count(data1.finished_tag) == 2);
+
+        std::tie(tag, count) = Tagger::get_tag(tag2);
         CHECK(tag.label == TagLabel::processing);
-        CHECK(tag.data == data2.data);
-        CHECK(count == 0);
-    }
+        CHECK(tag.data == &data1.unused);
+        CHECK(count == 1);
 
-    // invalid input
-    {
-        CHECK_THROWS(tagger.get_tag(nullptr));
-        CHECK(tagger.count(nullptr) == 0);
+        std::tie(tag, count) = Tagger::get_tag(tag1);
+        CHECK(tag.label == TagLabel::rpc_finished);
+        CHECK(count == 0);
     }
 }
 #endif
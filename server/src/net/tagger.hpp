@@ -1,8 +1,8 @@
 #pragma once
 
 // Standard
-#include <memory>
-#include <unordered_map>
+#include <atomic>
+#include <utility>
 
 namespace net {
 namespace detail {
@@ -10,28 +10,46 @@ namespace detail {
 enum class TagLabel {
     rpc_call_requested_by_client,
     processing,
+    reading,
+    connected,
     rpc_finished,
+    queue_delay_probe,
+    poller_tasks,
 };
 
+/**
+ * @brief The number of tags an object currently has on a completion queue.
+ */
+using TagCount = std::atomic<unsigned>;
+
+/**
+ * @brief Tags live inside the object they refer to (see `Connection` and `RpcCallHandle`) so
+ *        nothing is allocated or looked up when they are put on or taken off a completion queue.
+ *        Every tag belonging to the same object shares that object's `TagCount`.
+ */
 struct Tag {
     TagLabel label;
     void* data;
+    TagCount* count;
 };
 
 /**
- * @brief
+ * @brief Converts between tags and the `void*` ids gRPC puts on its completion queues while keeping
+ *        track of how many tags are outstanding for each object. A tag must not be put on a queue a
+ *        second time until it has been taken off. Safe to use from any thread.
  */
 class Tagger {
 public:
-    void* make_tag(TagLabel label, void* data);
-    std::pair<Tag, unsigned> get_tag(void* tag_id);
+    static void* make_tag(Tag* tag);
+    static std::pair<Tag, unsigned> get_tag(void* tag_id);
 
-    unsigned count(void* data);
-
-private:
-    std::unordered_map<void*, std::unique_ptr<Tag>> tags_;
-    std::unordered_map<void*, unsigned> counts_;
+    static unsigned count(const Tag& tag);
 };
 
+/**
+ * @brief The label's name as written in the source (e.g. "rpc_finished")
+ */
+const char* label_name(TagLabel label);
+
 } // namespace detail
 } // namespace net
@@ -0,0 +1,174 @@
+#include "thread_pool.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// standard
+#include <atomic>
+#include <stdexcept>
+
+namespace net {
+namespace {
+
+// The pool the current thread belongs to (if any) and the index of the queue it owns
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local std::size_t current_queue = 0u;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    if (num_threads == 0u) {
+        throw std::invalid_argument("ThreadPool needs at least one thread.");
+    }
+
+    for (auto i = 0u; i < num_threads; ++i) {
+        queues_.emplace_back(std::make_unique<TaskQueue>());
+    }
+    for (auto i = 0u; i < num_threads; ++i) {
+        threads_.emplace_back([this, i] { run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    std::size_t index;
+
+    if (current_pool == this) {
+        index = current_queue;
+    } else {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index = next_queue_;
+        next_queue_ = (next_queue_ + 1u) % queues_.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.emplace_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++queued_tasks_;
+        ++unfinished_tasks_;
+    }
+    work_available_.notify_one();
+}
+
+void ThreadPool::wait_until_idle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return unfinished_tasks_ <= 0; });
+}
+
+unsigned ThreadPool::num_threads() const {
+    return static_cast<unsigned>(threads_.size());
+}
+
+bool ThreadPool::take_task(std::size_t index, std::function<void()>* task) {
+    // Work on the thread's own queue in the order it was submitted
+    {
+        TaskQueue& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.tasks.empty()) {
+            *task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Then steal the most recently submitted task from another thread
+    for (auto offset = 1u; offset < queues_.size(); ++offset) {
+        TaskQueue& queue = *queues_[(index + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.tasks.empty()) {
+            *task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(std::size_t index) {
+    current_pool = this;
+    current_queue = index;
+
+    while (true) {
+        std::function<void()> task;
+
+        if (!take_task(index, &task)) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_available_.wait(lock, [this] { return queued_tasks_ > 0 || stopping_; });
+
+            if (queued_tasks_ <= 0) {
+                return;
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --queued_tasks_;
+        }
+
+        task();
+
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle = --unfinished_tasks_ <= 0;
+        }
+        if (idle) {
+            idle_.notify_all();
+        }
+    }
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("[net] test ThreadPool runs tasks while another task is blocked") {
+    ThreadPool pool(/*num_threads=*/2u);
+
+    std::mutex mutex;
+    std::condition_variable released;
+    bool release = false;
+
+    std::atomic_int tasks_run{0};
+
+    // Everything submitted from the blocked task lands on its queue and has to be stolen
+    pool.submit([&] {
+        for (int i = 0; i < 100; ++i) {
+            pool.submit([&tasks_run] { ++tasks_run; });
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [&release] { return release; });
+    });
+
+    while (tasks_run < 100) {
+        std::this_thread::yield();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    released.notify_all();
+
+    pool.wait_until_idle();
+    CHECK(tasks_run == 100);
+}
+#endif
+
+} // namespace net
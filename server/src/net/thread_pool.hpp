@@ -0,0 +1,69 @@
+#pragma once
+
+// standard
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace net {
+
+/**
+ * @brief A fixed set of threads that run submitted tasks.
+ *
+ *     Each thread has its own task queue. Tasks submitted from one of the pool's threads go on that
+ *     thread's queue and tasks submitted from anywhere else are spread over the queues in turn. A thread
+ *     that runs out of work steals from the back of the other queues, so one long task only holds up the
+ *     thread running it.
+ *
+ *     Tasks must not throw. Safe to use from any thread.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned num_threads);
+
+    /**
+     * @brief Runs every task that has already been submitted, then joins the threads.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief Blocks until every submitted task has finished running.
+     */
+    void wait_until_idle();
+
+    unsigned num_threads() const;
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable idle_;
+
+    // Signed since a task can be taken (or finish) before the submitting thread has counted it
+    std::ptrdiff_t queued_tasks_ = 0;
+    std::ptrdiff_t unfinished_tasks_ = 0;
+    std::size_t next_queue_ = 0u;
+    bool stopping_ = false;
+
+    bool take_task(std::size_t index, std::function<void()>* task);
+    void run(std::size_t index);
+};
+
+} // namespace net
@@ -0,0 +1,161 @@
+#include "tracer.hpp"
+
+// project
+#include "testing/testing.hpp"
+
+// standard
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace net {
+namespace {
+
+std::atomic<std::uint64_t> next_tracer_id{1u};
+
+struct CachedBuffer {
+    std::uint64_t tracer_id;
+    void* buffer;
+    unsigned thread;
+};
+
+// The buffers the current thread has been given by each tracer it recorded to
+thread_local std::vector<CachedBuffer> cached_buffers;
+
+void write_json_string(std::ostream& out, const char* value) {
+    out << '"';
+    for (const char* c = value; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+Tracer& Tracer::global() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer(std::size_t events_per_thread)
+    : id_(next_tracer_id.fetch_add(1u, std::memory_order_relaxed)), events_per_thread_(events_per_thread) {
+    if (events_per_thread == 0u) {
+        throw std::invalid_argument("Tracer needs room for at least one event per thread.");
+    }
+}
+
+void Tracer::record(const char* name,
+                    const char* category,
+                    std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end) {
+    unsigned thread = 0u;
+    ThreadBuffer* buffer = thread_buffer(&thread);
+
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    TraceEvent event{name, category, start, end - start, thread};
+
+    if (buffer->events.size() < events_per_thread_) {
+        buffer->events.emplace_back(event);
+        return;
+    }
+
+    buffer->events[buffer->next] = event;
+    buffer->next = (buffer->next + 1u) % events_per_thread_;
+}
+
+std::vector<TraceEvent> Tracer::events() {
+    std::vector<TraceEvent> events;
+
+    std::lock_guard<std::mutex> buffers_lock(buffers_mutex_);
+    for (auto& buffer : buffers_) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const TraceEvent& lhs, const TraceEvent& rhs) {
+        return lhs.start < rhs.start;
+    });
+    return events;
+}
+
+void Tracer::clear() {
+    std::lock_guard<std::mutex> buffers_lock(buffers_mutex_);
+    for (auto& buffer : buffers_) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        buffer->events.clear();
+        buffer->next = 0u;
+    }
+}
+
+void Tracer::write_chrome_trace(std::ostream& out) {
+    std::vector<TraceEvent> events = this->events();
+    auto origin = events.empty() ? std::chrono::steady_clock::time_point{} : events.front().start;
+
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+
+    for (auto i = 0u; i < events.size(); ++i) {
+        const TraceEvent& event = events[i];
+
+        out << (i == 0u ? "\n" : ",\n") << "{\"name\": ";
+        write_json_string(out, event.name);
+        out << ", \"cat\": ";
+        write_json_string(out, event.category);
+        out << ", \"ph\": \"X\", \"ts\": " << std::chrono::duration<double, std::micro>(event.start - origin).count()
+            << ", \"dur\": " << std::chrono::duration<double, std::micro>(event.duration).count()
+            << ", \"pid\": 1, \"tid\": " << event.thread << "}";
+    }
+    out << "\n]}\n";
+}
+
+Tracer::ThreadBuffer* Tracer::thread_buffer(unsigned* thread) {
+    for (const CachedBuffer& cached : cached_buffers) {
+        if (cached.tracer_id == id_) {
+            *thread = cached.thread;
+            return static_cast<ThreadBuffer*>(cached.buffer);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    buffers_.emplace_back(std::make_unique<ThreadBuffer>());
+    buffers_.back()->events.reserve(std::min(events_per_thread_, std::size_t{1024u}));
+
+    *thread = static_cast<unsigned>(buffers_.size());
+    cached_buffers.push_back(CachedBuffer{id_, buffers_.back().get(), *thread});
+    return buffers_.back().get();
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("[net] test Tracer keeps the latest events of each thread") {
+    Tracer tracer(/*events_per_thread=*/4u);
+
+    for (int i = 0; i < 6; ++i) {
+        TraceSpan span(i < 2 ? "old" : "new", "test", tracer);
+    }
+    std::thread([&tracer] { TraceSpan span("other \"thread\"", "test", tracer); }).join();
+
+    std::vector<TraceEvent> events = tracer.events();
+    REQUIRE(events.size() == 5u);
+
+    for (const TraceEvent& event : events) {
+        CHECK(std::string(event.name) != "old");
+    }
+    CHECK(events.back().thread == 2u);
+
+    std::ostringstream trace;
+    tracer.write_chrome_trace(trace);
+
+    CHECK(trace.str().find("\"name\": \"other \\\"thread\\\"\", \"cat\": \"test\", \"ph\": \"X\"") != std::string::npos);
+    CHECK(trace.str().find("\"tid\": 1}") != std::string::npos);
+
+    tracer.clear();
+    CHECK(tracer.events().empty());
+}
+#endif
+
+} // namespace net
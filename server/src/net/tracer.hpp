@@ -0,0 +1,121 @@
+#pragma once
+
+// standard
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Records a span named `name` from here to the end of the enclosing scope on `net::Tracer::global()`.
+ *
+ *     Compiled out entirely unless `HELLO_ENABLE_TRACING` is defined (see the `HELLO_ENABLE_TRACING`
+ *     CMake option). `name` and `category` must be string literals, or otherwise outlive the tracer,
+ *     since only the pointers are recorded.
+ */
+#ifdef HELLO_ENABLE_TRACING
+#define HELLO_TRACE_CONCAT_IMPL(a, b) a##b
+#define HELLO_TRACE_CONCAT(a, b) HELLO_TRACE_CONCAT_IMPL(a, b)
+#define HELLO_TRACE_SPAN(name, category) \
+    const ::net::TraceSpan HELLO_TRACE_CONCAT(hello_trace_span_, __LINE__)((name), (category))
+#else
+#define HELLO_TRACE_SPAN(name, category) static_cast<void>(0)
+#endif
+
+namespace net {
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::nanoseconds duration;
+    unsigned thread; // Numbered in the order threads first recorded to the tracer, starting at 1
+};
+
+/**
+ * @brief Keeps the most recent spans recorded by each thread in a fixed size ring buffer.
+ *
+ *     Every thread records to its own buffer so recording threads never wait on each other. A buffer's
+ *     mutex is only contended while the events are being copied out. Once a buffer is full the oldest
+ *     events are overwritten, so a tracer can be left running and dumped after a stall is noticed.
+ */
+class Tracer {
+public:
+    /**
+     * @brief Whether the `HELLO_TRACE_SPAN`s in the server were compiled in.
+     */
+#ifdef HELLO_ENABLE_TRACING
+    static constexpr bool compiled_in = true;
+#else
+    static constexpr bool compiled_in = false;
+#endif
+
+    /**
+     * @brief The tracer `HELLO_TRACE_SPAN` records to.
+     */
+    static Tracer& global();
+
+    explicit Tracer(std::size_t events_per_thread = 1u << 16u);
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    void record(const char* name,
+                const char* category,
+                std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end);
+
+    /**
+     * @brief The events still held by every thread's buffer, ordered by start time.
+     */
+    std::vector<TraceEvent> events();
+
+    void clear();
+
+    /**
+     * @brief Writes the events in the Chrome trace event format ("X" complete events in microseconds)
+     *        so they can be loaded into chrome://tracing or Perfetto and viewed as a flame chart per thread.
+     */
+    void write_chrome_trace(std::ostream& out);
+
+private:
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<TraceEvent> events; // A ring once full
+        std::size_t next = 0u;
+    };
+
+    const std::uint64_t id_; // Never reused, unlike the address, so threads can cache their buffer
+    const std::size_t events_per_thread_;
+
+    std::mutex buffers_mutex_;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+
+    ThreadBuffer* thread_buffer(unsigned* thread);
+};
+
+/**
+ * @brief Records the time between its construction and destruction. Use `HELLO_TRACE_SPAN` so the
+ *        span disappears when tracing is disabled.
+ */
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* category, Tracer& tracer = Tracer::global())
+        : tracer_(tracer), name_(name), category_(category), start_(std::chrono::steady_clock::now()) {}
+
+    ~TraceSpan() { tracer_.record(name_, category_, start_, std::chrono::steady_clock::now()); }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    Tracer& tracer_;
+    const char* name_;
+    const char* category_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace net
@@ -0,0 +1,41 @@
+#pragma once
+
+// system
+#include <dirent.h>
+#include <unistd.h>
+
+// standard
+#include <cstdlib>
+#include <string>
+
+namespace testing {
+
+/**
+ * @brief A temporary directory that is deleted along with its files.
+ */
+struct TemporaryDirectory {
+    std::string path;
+
+    TemporaryDirectory() {
+        std::string path_template = "/tmp/hello_test_XXXXXX";
+        path = ::mkdtemp(&path_template[0]);
+    }
+
+    ~TemporaryDirectory() {
+        if (DIR* directory = ::opendir(path.c_str())) {
+            while (dirent* entry = ::readdir(directory)) {
+                std::string name = entry->d_name;
+                if (name != "." && name != "..") {
+                    ::unlink((path + "/" + name).c_str());
+                }
+            }
+            ::closedir(directory);
+        }
+        ::rmdir(path.c_str());
+    }
+
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+};
+
+} // namespace testing
@@ -1,5 +1,8 @@
 #include "test_service.h"
 
+// standard
+#include <memory>
+
 namespace testing {
 
 grpc::Status TestService::operator()(const proto::EchoRequest& request, proto::EchoResponse* response) const {
@@ -10,13 +13,44 @@ grpc::Status TestService::operator()(const proto::EchoRequest& request, proto::E
 
 void TestService::operator()(const proto::EchoRequest& request,
                              net::ServerToClientStream<testing::proto::EchoResponse>* stream) const {
-    proto::EchoResponse response{};
     for (int i = 0; i < request.expected_responses(); ++i) {
-        response.set_message(request.message());
-        response.set_response_number(i);
-        stream->write(response);
+        stream->emplace([&request, i](proto::EchoResponse& response) {
+            response.set_message(request.message());
+            response.set_response_number(i);
+        });
     }
     stream->finish(grpc::Status::OK);
 }
 
+void TestService::operator()(net::ClientToServerStream<proto::EchoRequest, proto::EchoResponse>* stream) const {
+    // Responds with the last message and how many were sent
+    auto last_request = std::make_shared<proto::EchoRequest>();
+    auto requests = std::make_shared<int>(0);
+
+    stream->on_read([last_request, requests](const proto::EchoRequest& request) {
+        *last_request = request;
+        ++*requests;
+    });
+
+    stream->on_read_done([last_request, requests](proto::EchoResponse* response) {
+        response->set_message(last_request->message());
+        response->set_response_number(*requests);
+        return grpc::Status::OK;
+    });
+}
+
+void TestService::operator()(net::BidiStream<proto::EchoRequest, proto::EchoResponse>* stream) const {
+    // Echoes every request as soon as it's read
+    stream->on_read([stream](const proto::EchoRequest& request) {
+        for (int i = 0; i < request.expected_responses(); ++i) {
+            stream->emplace([&request, i](proto::EchoResponse& response) {
+                response.set_message(request.message());
+                response.set_response_number(i);
+            });
+        }
+    });
+
+    stream->on_read_done([stream] { stream->finish(grpc::Status::OK); });
+}
+
 } // namespace testing
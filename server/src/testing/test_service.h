@@ -5,12 +5,22 @@
 
 namespace testing {
 
+/**
+ * @brief The echo service with its server and bidirectional streams marked raw (see `net::raw_stream`)
+ */
+using EchoService = proto::Echo::WithRawMethod_ServerStreamEchoTest<
+    proto::Echo::WithRawMethod_BidiStreamEchoTest<proto::Echo::AsyncService>>;
+
 struct TestService {
     grpc::Status operator()(const testing::proto::EchoRequest& request, testing::proto::EchoResponse* response) const;
 
     void operator()(const proto::EchoRequest& request,
                     net::ServerToClientStream<testing::proto::EchoResponse>* stream) const;
 
+    void operator()(net::ClientToServerStream<proto::EchoRequest, proto::EchoResponse>* stream) const;
+
+    void operator()(net::BidiStream<proto::EchoRequest, proto::EchoResponse>* stream) const;
+
     std::unordered_set<net::ServerToClientStream<testing::proto::EchoResponse>*> client_connections;
 };
 